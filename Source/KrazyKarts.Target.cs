@@ -9,6 +9,15 @@ public class KrazyKartsTarget : TargetRules
 	{
 		Type = TargetType.Game;
 		DefaultBuildSettings = BuildSettingsVersion.V2;
+
+		// Push model changes how the engine itself is compiled, so it needs a build environment of its own, which only a source engine can build.
+		// Elsewhere the dirty marks compile to nothing and ServerState is compared on every replication pass
+		if (!UnrealBuildTool.IsEngineInstalled())
+		{
+			BuildEnvironment = TargetBuildEnvironment.Unique;
+			bWithPushModel = true;
+		}
+
 		ExtraModuleNames.Add("KrazyKarts");
 	}
 }
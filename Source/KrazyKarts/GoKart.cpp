@@ -6,6 +6,16 @@
 #include "Components\InputComponent.h"
 #include "DrawDebugHelpers.h"
 #include "GameFramework\GameStateBase.h"
+#include "KrazyKartsGameMode.h"
+#include "KrazyKartsMatchSubsystem.h"
+#include "KrazyKartsTrackProgressSubsystem.h"
+#include "HAL/IConsoleManager.h"
+#include "Components/MeshComponent.h"
+
+static TAutoConsoleVariable<int32> CVarShowNetRoles(
+	TEXT("KrazyKarts.ShowNetRoles"),
+	0,
+	TEXT("Draws the net roles above every AGoKart. Off by default, building the strings allocates every frame"));
 
 // Sets default values
 AGoKart::AGoKart()
@@ -17,20 +27,81 @@ AGoKart::AGoKart()
 
 	MovementComponent = CreateDefaultSubobject<UGoKartMovementComponent>(TEXT("MovementComponent"));
 	MovementReplicator = CreateDefaultSubobject<UGoKartMovementReplicator>(TEXT("MovementReplicator"));
+
+	/* The components don't register tick functions of their own, Tick runs them in a fixed order instead:
+	   input (the controller ticks before its pawn) -> create and simulate move -> replicate.
+	   That way the replicator always sees this frame's move, not last frame's */
+	MovementComponent->PrimaryComponentTick.bCanEverTick = false;
+	MovementReplicator->PrimaryComponentTick.bCanEverTick = false;
 }
 
 // Called when the game starts or when spawned
 void AGoKart::BeginPlay()
 {
 	Super::BeginPlay();
+
+	// The blueprint adds the mesh, so this is the first point where it exists
+	if (MovementReplicator != nullptr)
+	{
+		MovementReplicator->SetMeshOffsetRoot(FindMeshOffsetRoot());
+	}
 	
 	if (HasAuthority())
 	{
 		NetUpdateFrequency = 1; // 1 update per second
 	}
+
+	UKrazyKartsTrackProgressSubsystem* TrackProgress = GetWorld()->GetSubsystem<UKrazyKartsTrackProgressSubsystem>();
+	if (TrackProgress != nullptr)
+	{
+		TrackProgress->RegisterKart(this);
+	}
 }
 
+void AGoKart::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	UKrazyKartsTrackProgressSubsystem* TrackProgress = GetWorld()->GetSubsystem<UKrazyKartsTrackProgressSubsystem>();
+	if (TrackProgress != nullptr)
+	{
+		TrackProgress->UnregisterKart(this);
+	}
 
+	Super::EndPlay(EndPlayReason);
+}
+
+void AGoKart::FellOutOfWorld(const UDamageType& DamageType)
+{
+	// Clients wait for the server to respawn or destroy it, hiding it here would outlast the respawn
+	if (!HasAuthority()) return;
+
+	AKrazyKartsGameMode* GameMode = GetWorld()->GetAuthGameMode<AKrazyKartsGameMode>();
+	if (GameMode != nullptr && GetController() != nullptr)
+	{
+		GameMode->RespawnPlayer(GetController());
+		return;
+	}
+
+	Super::FellOutOfWorld(DamageType);
+}
+
+USceneComponent* AGoKart::FindMeshOffsetRoot() const
+{
+	for (UActorComponent* Component : GetComponents())
+	{
+		USceneComponent* SceneComponent = Cast<USceneComponent>(Component);
+		if (SceneComponent != nullptr && SceneComponent != RootComponent && SceneComponent->ComponentHasTag(MeshOffsetRootTag)) return SceneComponent;
+	}
+
+	if (RootComponent == nullptr) return nullptr;
+
+	// Only a child works, the root itself is what gets snapped to the server pose
+	for (USceneComponent* Child : RootComponent->GetAttachChildren())
+	{
+		if (Cast<UMeshComponent>(Child) != nullptr) return Child;
+	}
+
+	return nullptr;
+}
 
 FString GetEnumText(ENetRole Role)
 {
@@ -49,11 +120,37 @@ FString GetEnumText(ENetRole Role)
 	}
 }
 
+bool AGoKart::IsNetRelevantFor(const AActor* RealViewer, const AActor* ViewTarget, const FVector& SrcLocation) const
+{
+	const UKrazyKartsMatchSubsystem* MatchSubsystem = GetWorld()->GetSubsystem<UKrazyKartsMatchSubsystem>();
+	if (MatchSubsystem != nullptr && !MatchSubsystem->AreInSameMatch(this, RealViewer)) return false;
+
+	return Super::IsNetRelevantFor(RealViewer, ViewTarget, SrcLocation);
+}
+
+float AGoKart::GetNetPriority(const FVector& ViewPos, const FVector& ViewDir, AActor* Viewer, AActor* ViewTarget, UActorChannel* InChannel, float Time, bool bLowBandwidth)
+{
+	float Priority = Super::GetNetPriority(ViewPos, ViewDir, Viewer, ViewTarget, InChannel, Time, bLowBandwidth);
+
+	const UKrazyKartsTrackProgressSubsystem* TrackProgress = GetWorld()->GetSubsystem<UKrazyKartsTrackProgressSubsystem>();
+	return TrackProgress != nullptr ? Priority * TrackProgress->GetNetPriorityScale(this, ViewTarget) : Priority;
+}
+
 // Called every frame
 void AGoKart::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
 
+	FKrazyKartsMatchTickScope MatchTickScope(this);
+
+	if (MovementComponent != nullptr && MovementReplicator != nullptr)
+	{
+		MovementComponent->TickMovement(DeltaTime);
+		MovementReplicator->TickReplication(DeltaTime);
+	}
+
+	// Nobody can see debug strings on a dedicated server, and elsewhere only who asked for them pays for building them
+	if (GetNetMode() == NM_DedicatedServer || CVarShowNetRoles.GetValueOnGameThread() == 0) return;
 
 	// DEBUGGING
 	DrawDebugString(GetWorld(), FVector(0, 0, 140), "LocalRole: " + GetEnumText(GetLocalRole()), this, FColor::White, DeltaTime);
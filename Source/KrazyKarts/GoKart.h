@@ -25,9 +25,20 @@ protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
 
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 public:	
 	// Called every frame
 	virtual void Tick(float DeltaTime) override;
+
+	/** Karts are only sent to players of their own match */
+	virtual bool IsNetRelevantFor(const AActor* RealViewer, const AActor* ViewTarget, const FVector& SrcLocation) const override;
+
+	/** Karts racing close to the viewer's position replicate first */
+	virtual float GetNetPriority(const FVector& ViewPos, const FVector& ViewDir, AActor* Viewer, AActor* ViewTarget, UActorChannel* InChannel, float Time, bool bLowBandwidth) override;
+
+	/** A player's kart goes back to the pool and restarts at a start spot instead of being destroyed */
+	virtual void FellOutOfWorld(const UDamageType& DamageType) override;
 	
 
 	// Called to bind functionality to input
@@ -43,10 +54,17 @@ private:
 
 	void MoveRight(float Value);
 
+	/** The component the replicator eases back after a correction: the one tagged MeshOffsetRootTag, else the first mesh below the root */
+	USceneComponent* FindMeshOffsetRoot() const;
+
 	UPROPERTY(VisibleAnywhere)
 	UGoKartMovementComponent* MovementComponent;
 
 	UPROPERTY(VisibleAnywhere)
 	UGoKartMovementReplicator* MovementReplicator;
 
+	// Tag of the component holding the kart's visuals, for blueprints where it isn't the first mesh below the root
+	UPROPERTY(EditDefaultsOnly)
+	FName MeshOffsetRootTag = TEXT("MeshOffsetRoot");
+
 };
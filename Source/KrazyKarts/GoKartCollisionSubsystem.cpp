@@ -0,0 +1,115 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartCollisionSubsystem.h"
+#include "KrazyKarts.h"
+#include "GoKartMovementComponent.h"
+
+DECLARE_CYCLE_STAT(TEXT("Kart Broadphase"), STAT_KartBroadphase, STATGROUP_KrazyKarts);
+
+void UGoKartCollisionSubsystem::RegisterKart(UGoKartMovementComponent* Kart)
+{
+	if (Kart == nullptr || KartCells.Contains(Kart)) return;
+
+	FIntPoint Cell = GetCell(Kart->GetOwner()->GetActorLocation());
+	Grid.FindOrAdd(Cell).Add(Kart);
+	KartCells.Add(Kart, Cell);
+}
+
+template <typename FGrid>
+static void RemoveKartFromCell(FGrid& Grid, const FIntPoint& Cell, UGoKartMovementComponent* Kart)
+{
+	auto* CellKarts = Grid.Find(Cell);
+	if (CellKarts == nullptr) return;
+
+	CellKarts->RemoveSingleSwap(Kart, false);
+	if (CellKarts->Num() == 0)
+	{
+		Grid.Remove(Cell);
+	}
+}
+
+void UGoKartCollisionSubsystem::UnregisterKart(UGoKartMovementComponent* Kart)
+{
+	FIntPoint Cell;
+	if (!KartCells.RemoveAndCopyValue(Kart, Cell)) return;
+
+	RemoveKartFromCell(Grid, Cell, Kart);
+}
+
+FIntPoint UGoKartCollisionSubsystem::GetCell(const FVector& Location) const
+{
+	return FIntPoint(FMath::FloorToInt(Location.X / CellSize), FMath::FloorToInt(Location.Y / CellSize));
+}
+
+void UGoKartCollisionSubsystem::UpdateCell(UGoKartMovementComponent* Kart)
+{
+	FIntPoint* OldCell = KartCells.Find(Kart);
+	if (OldCell == nullptr) return;
+
+	FIntPoint NewCell = GetCell(Kart->GetOwner()->GetActorLocation());
+	if (NewCell == *OldCell) return; // Most moves stay in the same cell, so this is the common path
+
+	RemoveKartFromCell(Grid, *OldCell, Kart);
+	Grid.FindOrAdd(NewCell).Add(Kart);
+	*OldCell = NewCell;
+}
+
+void UGoKartCollisionSubsystem::ResolveKartCollisions(UGoKartMovementComponent* Kart)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartBroadphase);
+
+	UpdateCell(Kart);
+
+	const FIntPoint* Cell = KartCells.Find(Kart);
+	if (Cell == nullptr) return;
+
+	AActor* Owner = Kart->GetOwner();
+
+	for (int32 CellX = Cell->X - 1; CellX <= Cell->X + 1; ++CellX)
+	{
+		for (int32 CellY = Cell->Y - 1; CellY <= Cell->Y + 1; ++CellY)
+		{
+			const FCellKarts* CellKarts = Grid.Find(FIntPoint(CellX, CellY));
+			if (CellKarts == nullptr) continue;
+
+			for (UGoKartMovementComponent* Other : *CellKarts)
+			{
+				if (Other == Kart) continue;
+
+				AActor* OtherOwner = Other->GetOwner();
+
+				FVector Delta = OtherOwner->GetActorLocation() - Owner->GetActorLocation();
+				Delta.Z = 0;
+
+				float MinDistance = Kart->GetCollisionRadius() + Other->GetCollisionRadius();
+				float DistanceSquared = Delta.SizeSquared();
+				if (DistanceSquared >= FMath::Square(MinDistance) || DistanceSquared < KINDA_SMALL_NUMBER) continue;
+
+				float Distance = FMath::Sqrt(DistanceSquared);
+				FVector Normal = Delta / Distance; // Points from Kart to Other
+
+				float InvMass = 1 / Kart->GetMass();
+				float OtherInvMass = 1 / Other->GetMass();
+				float InvMassSum = InvMass + OtherInvMass;
+
+				// Push the karts apart, the lighter one moves more. Not swept, the overlap is always small at kart speeds
+				float Penetration = MinDistance - Distance;
+				Owner->AddActorWorldOffset(-Normal * Penetration * (InvMass / InvMassSum));
+				OtherOwner->AddActorWorldOffset(Normal * Penetration * (OtherInvMass / InvMassSum));
+
+				// Only exchange momentum if they are moving towards each other, otherwise they are already separating
+				FVector Velocity = Kart->GetVelocity();
+				FVector OtherVelocity = Other->GetVelocity();
+				float ClosingSpeed = FVector::DotProduct(OtherVelocity - Velocity, Normal);
+				if (ClosingSpeed >= 0) continue;
+
+				float Restitution = FMath::Min(Kart->GetRestitution(), Other->GetRestitution());
+				float Impulse = -(1 + Restitution) * ClosingSpeed / InvMassSum;
+
+				Kart->SetVelocity(Velocity - Normal * Impulse * InvMass);
+				Other->SetVelocity(OtherVelocity + Normal * Impulse * OtherInvMass);
+			}
+		}
+	}
+}
@@ -0,0 +1,47 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "GoKartCollisionSubsystem.generated.h"
+
+class UGoKartMovementComponent;
+
+/**
+ * Kart-vs-kart broadphase for the custom movement path.
+ * Karts are treated as circles on the XY plane and bucketed in a uniform grid, so a move only tests the karts
+ * in the 3x3 cells around it instead of sweeping the whole physics scene. Static geometry is still handled by
+ * the world sweep in UGoKartMovementComponent::UpdateLocation.
+ */
+UCLASS()
+class KRAZYKARTS_API UGoKartCollisionSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+
+	void RegisterKart(UGoKartMovementComponent* Kart);
+
+	void UnregisterKart(UGoKartMovementComponent* Kart);
+
+	/** Re-buckets the kart after it moved, then separates it from any overlapping kart and exchanges momentum along the contact normal */
+	void ResolveKartCollisions(UGoKartMovementComponent* Kart);
+
+	/** Only re-buckets the kart after it moved, for moves that must not touch the other karts */
+	void UpdateCell(UGoKartMovementComponent* Kart);
+
+	// Edge length of a grid cell (cm). Must be at least the largest kart diameter so the 3x3 neighbourhood is enough
+	static constexpr float CellSize = 500.f;
+
+private:
+
+	FIntPoint GetCell(const FVector& Location) const;
+
+	// Karts of a cell are stored inline, so crossing into an empty cell reuses the map's free slot instead of allocating a new array
+	using FCellKarts = TArray<UGoKartMovementComponent*, TInlineAllocator<4>>;
+
+	TMap<FIntPoint, FCellKarts> Grid;
+
+	TMap<UGoKartMovementComponent*, FIntPoint> KartCells;
+};
@@ -0,0 +1,54 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Integration steps for the force model of UGoKartMovementComponent.
+ * Each policy advances the velocity over DeltaTime, given a function returning the acceleration (m/s^2) at a velocity (m/s),
+ * and also returns the velocity the kart should travel with over the step.
+ */
+
+/** Moves with the old velocity. First order, and drifts at large steps as the drag is always a step late */
+struct FGoKartExplicitEuler
+{
+	static constexpr int32 Evaluations = 1;
+
+	template <typename FAccelerationFunc>
+	static FORCEINLINE void Integrate(const FVector& Velocity, float DeltaTime, FAccelerationFunc&& GetAcceleration, FVector& OutVelocity, FVector& OutTravelVelocity)
+	{
+		OutVelocity = Velocity + GetAcceleration(Velocity) * DeltaTime;
+		OutTravelVelocity = Velocity;
+	}
+};
+
+/** Moves with the new velocity. Same cost as explicit Euler but far better behaved, and what the kart always did */
+struct FGoKartSemiImplicitEuler
+{
+	static constexpr int32 Evaluations = 1;
+
+	template <typename FAccelerationFunc>
+	static FORCEINLINE void Integrate(const FVector& Velocity, float DeltaTime, FAccelerationFunc&& GetAcceleration, FVector& OutVelocity, FVector& OutTravelVelocity)
+	{
+		OutVelocity = Velocity + GetAcceleration(Velocity) * DeltaTime;
+		OutTravelVelocity = OutVelocity;
+	}
+};
+
+/** RK2: the acceleration is taken half way through the step. Second order, for twice the force evaluations */
+struct FGoKartMidpoint
+{
+	static constexpr int32 Evaluations = 2;
+
+	template <typename FAccelerationFunc>
+	static FORCEINLINE void Integrate(const FVector& Velocity, float DeltaTime, FAccelerationFunc&& GetAcceleration, FVector& OutVelocity, FVector& OutTravelVelocity)
+	{
+		FVector MidVelocity = Velocity + GetAcceleration(Velocity) * (0.5f * DeltaTime);
+		OutVelocity = Velocity + GetAcceleration(MidVelocity) * DeltaTime;
+		OutTravelVelocity = MidVelocity;
+	}
+};
+
+/** The integrator SimulateMove and PredictMove use. Client and server must agree on it, it is part of the simulation */
+using FGoKartIntegrator = FGoKartSemiImplicitEuler;
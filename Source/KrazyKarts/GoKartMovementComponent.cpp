@@ -2,7 +2,17 @@
 
 
 #include "GoKartMovementComponent.h"
-#include "GameFramework\GameStateBase.h"
+#include "GoKartCollisionSubsystem.h"
+#include "GoKartSurfaceSubsystem.h"
+#include "GoKartIntegrators.h"
+#include "KrazyKarts.h"
+#include "PhysicsEngine/PhysicsSettings.h"
+#include "HAL/IConsoleManager.h"
+
+static FAutoConsoleCommand BenchmarkIntegratorsCommand(
+	TEXT("KrazyKarts.BenchmarkIntegrators"),
+	TEXT("Compares position error and cost of the kart integrators at several step sizes"),
+	FConsoleCommandDelegate::CreateStatic(&UGoKartMovementComponent::RunIntegratorBenchmark));
 
 // Sets default values for this component's properties
 UGoKartMovementComponent::UGoKartMovementComponent()
@@ -19,8 +29,39 @@ void UGoKartMovementComponent::BeginPlay()
 {
 	Super::BeginPlay();
 
-	// ...
-	
+	SurfaceSubsystem = GetWorld()->GetSubsystem<UGoKartSurfaceSubsystem>();
+
+	PreviousStepTransform = GetOwner()->GetActorTransform();
+
+	if (!bUseKartBroadphase) return;
+
+	CollisionSubsystem = GetWorld()->GetSubsystem<UGoKartCollisionSubsystem>();
+	if (CollisionSubsystem == nullptr) return;
+
+	CollisionSubsystem->RegisterKart(this);
+
+	// The world sweep only handles static geometry, karts are resolved by the broadphase instead.
+	// Ignoring our own object type alone would still let pawns, vehicles and physics bodies block the sweep
+	UPrimitiveComponent* Root = Cast<UPrimitiveComponent>(GetOwner()->GetRootComponent());
+	if (Root != nullptr)
+	{
+		Root->SetCollisionResponseToChannel(Root->GetCollisionObjectType(), ECR_Ignore);
+		Root->SetCollisionResponseToChannel(ECC_WorldDynamic, ECR_Ignore);
+		Root->SetCollisionResponseToChannel(ECC_Pawn, ECR_Ignore);
+		Root->SetCollisionResponseToChannel(ECC_PhysicsBody, ECR_Ignore);
+		Root->SetCollisionResponseToChannel(ECC_Vehicle, ECR_Ignore);
+		Root->SetCollisionResponseToChannel(ECC_Destructible, ECR_Ignore);
+	}
+}
+
+void UGoKartMovementComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (CollisionSubsystem != nullptr)
+	{
+		CollisionSubsystem->UnregisterKart(this);
+	}
+
+	Super::EndPlay(EndPlayReason);
 }
 
 
@@ -29,33 +70,145 @@ void UGoKartMovementComponent::TickComponent(float DeltaTime, ELevelTick TickTyp
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 
+	TickMovement(DeltaTime);
+}
+
+void UGoKartMovementComponent::TickMovement(float DeltaTime)
+{
 	// Can we use IsLocallyControlled instead of all this if statement?
 	// This means don't execute if we ARE the SimulatedProxy, or if we are the server and there is an AutonomousProxy on the other side
+	bHasNewMove = false;
 	if (GetOwnerRole() == ROLE_AutonomousProxy || GetOwner()->GetRemoteRole() == ROLE_SimulatedProxy) 
 	{
-		LastMove = CreateMove(DeltaTime);
-		SimulateMove(LastMove);
+		float StepTime = ConsumeSimulationSteps(DeltaTime);
+		if (StepTime <= 0) return;
+
+		LastMove = CreateMove(StepTime);
+		SimulateRun(LastMove);
+		bHasNewMove = true;
 	}
+}
+
+float UGoKartMovementComponent::ConsumeSimulationSteps(float DeltaTime)
+{
+	bInterpolateSteps = true;
+	UnsimulatedTime += DeltaTime;
+
+	// The tolerance keeps float error in the sum from holding back a step that is really there.
+	// A hitch longer than a move may be is caught up over the next frames
+	float Step = GetSimulationStep();
+	int32 MaxSteps = FMath::Min(MaxStepsPerMove, (int32)MAX_uint16 / GetSimulationStepUnits());
+	int32 NumSteps = FMath::Min(FMath::FloorToInt(UnsimulatedTime / Step + KINDA_SMALL_NUMBER), MaxSteps);
+
+	UnsimulatedTime = FMath::Max(UnsimulatedTime - NumSteps * Step, 0.f);
+	return NumSteps * Step;
+}
+
+void UGoKartMovementComponent::ResetSimulationSteps()
+{
+	UnsimulatedTime = 0;
+	PreviousStepTransform = GetOwner()->GetActorTransform();
+}
+
+FTransform UGoKartMovementComponent::GetInterpolatedTransform() const
+{
+	const FTransform& Current = GetOwner()->GetActorTransform();
+	if (!bInterpolateSteps) return Current;
 
+	// One step behind the simulation, so the pose never has to be guessed ahead
+	FTransform Interpolated;
+	Interpolated.Blend(PreviousStepTransform, Current, FMath::Clamp(UnsimulatedTime / GetSimulationStep(), 0.f, 1.f));
+	return Interpolated;
 }
 
 
+template <typename TIntegrator>
+void UGoKartMovementComponent::IntegrateMove(const FGoKartMove& Move, const FTransform& Transform, FVector& InOutVelocity, FQuat& OutRotationDelta, FVector& OutTranslation) const
+{
+	const FVector Forward = Transform.GetRotation().GetForwardVector();
+	const FVector DrivingForce = Forward * MaxDrivingForce * Move.Throttle;
+	const FVector Location = Transform.GetLocation();
+
+	auto GetMoveAcceleration = [this, &DrivingForce, &Location](const FVector& AtVelocity)
+	{
+		return GetAcceleration(DrivingForce, AtVelocity, Location);
+	};
+
+	const FVector StartVelocity = InOutVelocity;
+	FVector TravelVelocity;
+	TIntegrator::Integrate(StartVelocity, Move.DeltaTime, GetMoveAcceleration, InOutVelocity, TravelVelocity);
+
+	// Steering turns the kart by how far it went forward, and the velocity turns with it
+	OutRotationDelta = GetRotationDelta(Forward, Transform.GetRotation().GetUpVector(), InOutVelocity, Move.DeltaTime, Move.SteeringThrow);
+	InOutVelocity = OutRotationDelta.RotateVector(InOutVelocity);
+	OutTranslation = OutRotationDelta.RotateVector(TravelVelocity) * Move.DeltaTime * CentimetersPerMeter;
+}
+
 void UGoKartMovementComponent::SimulateMove(const FGoKartMove& Move)
 {
 	/* We don't want to get the input data from the actor, especially if we're not locally controlled..We want to get it from the Move */
 
-	FVector Force = GetOwner()->GetActorForwardVector() * MaxDrivingForce * Move.Throttle;
+	PreviousStepTransform = GetOwner()->GetActorTransform();
 
-	Force += GetAirResistance();
-	Force += GetRollingResistance();
+	FQuat RotationDelta;
+	FVector Translation;
+	IntegrateMove<FGoKartIntegrator>(Move, PreviousStepTransform, Velocity, RotationDelta, Translation);
 
-	FVector Acceleration = Force / Mass;
+	GetOwner()->AddActorWorldRotation(RotationDelta);
 
-	Velocity = Velocity + Acceleration * Move.DeltaTime;
+	UpdateLocation(Translation);
+}
 
-	ApplyRotation(Move.DeltaTime, Move.SteeringThrow);
+void UGoKartMovementComponent::PredictMove(const FGoKartMove& Move, FTransform& InOutTransform, FVector& InOutVelocity) const
+{
+	FQuat RotationDelta;
+	FVector Translation;
+	IntegrateMove<FGoKartIntegrator>(Move, InOutTransform, InOutVelocity, RotationDelta, Translation);
+
+	InOutTransform.SetRotation(RotationDelta * InOutTransform.GetRotation());
+	InOutTransform.AddToTranslation(Translation); // No sweep, this is only an estimate of where the kart should be
+}
+
+int32 UGoKartMovementComponent::GetSimulationStepUnits() const
+{
+	return FMath::Max(1, FMath::FloorToInt(MaxSimulationStep * FGoKartPackedMove::DeltaTimeUnitsPerSecond));
+}
 
-	UpdateLocationFromVelocity(Move.DeltaTime);
+int32 UGoKartMovementComponent::GetNumRunSteps(float DeltaTime) const
+{
+	// Counted in packed units, so a run of whole steps is never cut into one step more through rounding
+	int32 Units = FMath::RoundToInt(DeltaTime * FGoKartPackedMove::DeltaTimeUnitsPerSecond);
+	return FMath::Max(1, FMath::DivideAndRoundUp(Units, GetSimulationStepUnits()));
+}
+
+void UGoKartMovementComponent::SimulateRun(const FGoKartMove& Run)
+{
+	int32 NumSteps = GetNumRunSteps(Run.DeltaTime);
+
+	FGoKartMove Step = Run;
+	Step.DeltaTime = Run.DeltaTime / NumSteps;
+	for (int32 i = 0; i < NumSteps; ++i)
+	{
+		SimulateMove(Step);
+	}
+}
+
+void UGoKartMovementComponent::ReplayRun(const FGoKartMove& Run)
+{
+	TGuardValue<bool> ReplayingGuard(bReplaying, true);
+	SimulateRun(Run);
+}
+
+void UGoKartMovementComponent::PredictRun(const FGoKartMove& Run, FTransform& InOutTransform, FVector& InOutVelocity) const
+{
+	int32 NumSteps = GetNumRunSteps(Run.DeltaTime);
+
+	FGoKartMove Step = Run;
+	Step.DeltaTime = Run.DeltaTime / NumSteps;
+	for (int32 i = 0; i < NumSteps; ++i)
+	{
+		PredictMove(Step, InOutTransform, InOutVelocity);
+	}
 }
 
 FGoKartMove UGoKartMovementComponent::CreateMove(float DeltaTime)
@@ -64,39 +217,63 @@ FGoKartMove UGoKartMovementComponent::CreateMove(float DeltaTime)
 	Move.DeltaTime = DeltaTime;
 	Move.SteeringThrow = SteeringThrow;
 	Move.Throttle = Throttle;
-	Move.Time = GetWorld()->GetGameState()->GetServerWorldTimeSeconds();
+	Move.Sequence = NextMoveSequence++;
 
-	return Move;
+	// Simulate exactly what the server will get, otherwise every move would leave a small error to correct
+	return FGoKartPackedMove::Pack(Move).Unpack();
 }
 
 
-FVector UGoKartMovementComponent::GetAirResistance()
+bool FGoKartPackedMove::NetSerialize(FArchive& Ar, class UPackageMap* Map, bool& bOutSuccess)
 {
-	return -Velocity.GetSafeNormal() * Velocity.SizeSquared() * DragCoefficient; // SizeSquared = Square(Velocity.Size())
+	Ar << Throttle;
+	Ar << SteeringThrow;
+	Ar << DeltaTime;
+	Ar << Sequence;
+
+	bOutSuccess = true;
+	return true;
 }
 
-FVector UGoKartMovementComponent::GetRollingResistance()
+FVector UGoKartMovementComponent::GetAcceleration(const FVector& DrivingForce, const FVector& AtVelocity, const FVector& Location) const
 {
-	float AccelerationDueToGravity = -GetWorld()->GetGravityZ() / 100;
-	float NormalForce = Mass * AccelerationDueToGravity;
-	return -Velocity.GetSafeNormal() * RollingResistanceCoefficient * NormalForce;
+	return (DrivingForce + GetAirResistance(AtVelocity) + GetRollingResistance(AtVelocity, Location)) / Mass;
 }
 
-void UGoKartMovementComponent::ApplyRotation(float DeltaTime, float InSteeringThrow)
+FVector UGoKartMovementComponent::GetAirResistance(const FVector& InVelocity) const
 {
-	float DeltaLocation = FVector::DotProduct(GetOwner()->GetActorForwardVector(), Velocity) * DeltaTime; // Dot gives what portion of the velocity vector is in the forward, if negative, will give negative number
-	float RotationAngle = DeltaLocation / MinTurningRadius * InSteeringThrow;
-	FQuat RotationDelta(GetOwner()->GetActorUpVector(), RotationAngle); // RotationAngle is in degrees, while this function takes radians
+	return -InVelocity.GetSafeNormal() * InVelocity.SizeSquared() * DragCoefficient; // SizeSquared = Square(Velocity.Size())
+}
 
-	Velocity = RotationDelta.RotateVector(Velocity);
+FVector UGoKartMovementComponent::GetRollingResistance(const FVector& InVelocity, const FVector& Location) const
+{
+	float NormalForce = Mass * GetAccelerationDueToGravity();
 
-	GetOwner()->AddActorWorldRotation(RotationDelta);
+	float Coefficient = RollingResistanceCoefficient;
+	if (SurfaceSubsystem != nullptr)
+	{
+		Coefficient *= SurfaceSubsystem->GetRollingResistanceScale(SurfaceSubsystem->GetSurface(Location).SurfaceType);
+	}
+
+	return -InVelocity.GetSafeNormal() * Coefficient * NormalForce;
+}
+
+float UGoKartMovementComponent::GetAccelerationDueToGravity() const
+{
+	UWorld* World = GetWorld();
+	float GravityZ = (World != nullptr) ? World->GetGravityZ() : UPhysicsSettings::Get()->DefaultGravityZ;
+	return -GravityZ / CentimetersPerMeter;
 }
 
-void UGoKartMovementComponent::UpdateLocationFromVelocity(float DeltaTime)
+FQuat UGoKartMovementComponent::GetRotationDelta(const FVector& Forward, const FVector& Up, const FVector& InVelocity, float DeltaTime, float InSteeringThrow) const
 {
-	FVector Translation = Velocity * DeltaTime * 100; // Multiplying by deltatime makes it just meters now, multiplying by 100 makes it centimeters. So now we are adding this movement per tick (20 meters per second)
+	float DeltaLocation = FVector::DotProduct(Forward, InVelocity) * DeltaTime; // Dot gives what portion of the velocity vector is in the forward, if negative, will give negative number
+	float RotationAngle = DeltaLocation / MinTurningRadius * InSteeringThrow;
+	return FQuat(Up, RotationAngle); // RotationAngle is in degrees, while this function takes radians
+}
 
+void UGoKartMovementComponent::UpdateLocation(const FVector& Translation)
+{
 	FHitResult Hit;
 	GetOwner()->AddActorWorldOffset(Translation, true, &Hit);
 
@@ -105,4 +282,75 @@ void UGoKartMovementComponent::UpdateLocationFromVelocity(float DeltaTime)
 	{
 		Velocity = FVector::ZeroVector;
 	}
+
+	if (CollisionSubsystem == nullptr) return;
+
+	if (bReplaying)
+	{
+		CollisionSubsystem->UpdateCell(this);
+	}
+	else
+	{
+		CollisionSubsystem->ResolveKartCollisions(this);
+	}
+}
+
+/** Straight run from rest, full throttle then coasting, with the kart's default parameters. Returns the distance covered (m) */
+template <typename TIntegrator, typename FAccelerationFunc>
+static float RunStraight(float DeltaTime, float Duration, FAccelerationFunc&& GetAcceleration)
+{
+	FVector Velocity = FVector::ZeroVector;
+	float Distance = 0;
+	int32 NumSteps = FMath::RoundToInt(Duration / DeltaTime);
+	for (int32 Step = 0; Step < NumSteps; ++Step)
+	{
+		float Throttle = Step * DeltaTime < Duration / 2 ? 1.f : 0.f;
+		FVector NewVelocity;
+		FVector TravelVelocity;
+		TIntegrator::Integrate(Velocity, DeltaTime, [&GetAcceleration, Throttle](const FVector& AtVelocity) { return GetAcceleration(AtVelocity, Throttle); }, NewVelocity, TravelVelocity);
+		Velocity = NewVelocity;
+		Distance += TravelVelocity.X * DeltaTime;
+	}
+	return Distance;
+}
+
+template <typename TIntegrator, typename FAccelerationFunc>
+static void BenchmarkIntegrator(const TCHAR* Name, float ReferenceDistance, float Duration, FAccelerationFunc&& GetAcceleration)
+{
+	static constexpr float StepSizes[] = { 1.f / 120.f, 1.f / 60.f, 1.f / 30.f, 1.f / 10.f, 1.f / 4.f };
+	static constexpr int32 Repetitions = 200;
+
+	for (float DeltaTime : StepSizes)
+	{
+		float Distance = 0;
+		double StartTime = FPlatformTime::Seconds();
+		for (int32 i = 0; i < Repetitions; ++i)
+		{
+			Distance = RunStraight<TIntegrator>(DeltaTime, Duration, GetAcceleration);
+		}
+		double Seconds = FPlatformTime::Seconds() - StartTime;
+		double NumSteps = (double)Repetitions * FMath::RoundToInt(Duration / DeltaTime);
+
+		UE_LOG(LogKrazyKarts, Log, TEXT("%-18s dt %.4f s: error %8.3f m, %6.1f ns/step, %4d force evaluations per simulated second"),
+			Name, DeltaTime, FMath::Abs(Distance - ReferenceDistance), Seconds * 1e9 / NumSteps, FMath::RoundToInt(TIntegrator::Evaluations / DeltaTime));
+	}
+}
+
+void UGoKartMovementComponent::RunIntegratorBenchmark()
+{
+	const UGoKartMovementComponent* Defaults = GetDefault<UGoKartMovementComponent>();
+	const float Duration = 10.f;
+
+	// The same force model IntegrateMove steps, along X. The class default object has no world, so no surface scale and the project's gravity
+	auto GetAcceleration = [Defaults](const FVector& AtVelocity, float Throttle)
+	{
+		return Defaults->GetAcceleration(FVector::ForwardVector * Defaults->MaxDrivingForce * Throttle, AtVelocity, FVector::ZeroVector);
+	};
+
+	float ReferenceDistance = RunStraight<FGoKartMidpoint>(1.f / 10000.f, Duration, GetAcceleration);
+	UE_LOG(LogKrazyKarts, Log, TEXT("Integrators, %.0f s straight run, reference distance %.3f m"), Duration, ReferenceDistance);
+
+	BenchmarkIntegrator<FGoKartExplicitEuler>(TEXT("ExplicitEuler"), ReferenceDistance, Duration, GetAcceleration);
+	BenchmarkIntegrator<FGoKartSemiImplicitEuler>(TEXT("SemiImplicitEuler"), ReferenceDistance, Duration, GetAcceleration);
+	BenchmarkIntegrator<FGoKartMidpoint>(TEXT("Midpoint"), ReferenceDistance, Duration, GetAcceleration);
 }
@@ -25,13 +25,77 @@ struct FGoKartMove
 	float DeltaTime; // To be able to simulate the move
 
 	/** What if by chance, 2 moves were exactly the same ? We need to add something to identify them
-	*We use a Time var, so that when we receive the last move from the server, we can go through our list of unacknowledged moves,
+	*We use a Sequence number, so that when we receive the last move from the server, we can go through our list of unacknowledged moves,
 		and check if they are before or equal to that last move. If they are before, we can remove them as they are old moves
 		And the greater/newer ones are the ones which will stay in that list and get replayed */
 	UPROPERTY()
-	float Time;
+	uint32 Sequence;
 };
 
+/** FGoKartMove in 8 bytes, for the unacknowledged queue, the server buffer and the wire.
+Inputs are quantized to a byte each and DeltaTime to 1/64 ms, CreateMove runs every move through it so client and server simulate the same values.
+Between client and server one of these is a run: the inputs were held for all of DeltaTime, over however many client frames that took */
+USTRUCT()
+struct FGoKartPackedMove
+{
+	GENERATED_BODY()
+
+	static constexpr float InputScale = 127.f;
+	static constexpr float DeltaTimeUnitsPerSecond = 64000.f; // 1/64 ms, so up to ~1 s fits in 16 bits
+
+	UPROPERTY()
+	int8 Throttle = 0;
+
+	UPROPERTY()
+	int8 SteeringThrow = 0;
+
+	UPROPERTY()
+	uint16 DeltaTime = 0;
+
+	UPROPERTY()
+	uint32 Sequence = 0;
+
+	static FGoKartPackedMove Pack(const FGoKartMove& Move)
+	{
+		FGoKartPackedMove Packed;
+		Packed.Throttle = (int8)FMath::RoundToInt(FMath::Clamp(Move.Throttle, -1.f, 1.f) * InputScale);
+		Packed.SteeringThrow = (int8)FMath::RoundToInt(FMath::Clamp(Move.SteeringThrow, -1.f, 1.f) * InputScale);
+		Packed.DeltaTime = (uint16)FMath::Clamp(FMath::RoundToInt(Move.DeltaTime * DeltaTimeUnitsPerSecond), 0, (int32)MAX_uint16);
+		Packed.Sequence = Move.Sequence;
+		return Packed;
+	}
+
+	FGoKartMove Unpack() const
+	{
+		FGoKartMove Move;
+		Move.Throttle = Throttle / InputScale;
+		Move.SteeringThrow = SteeringThrow / InputScale;
+		Move.DeltaTime = GetDeltaTime();
+		Move.Sequence = Sequence;
+		return Move;
+	}
+
+	float GetDeltaTime() const { return DeltaTime / DeltaTimeUnitsPerSecond; }
+
+	bool HasSameInputs(const FGoKartPackedMove& Other) const { return Throttle == Other.Throttle && SteeringThrow == Other.SteeringThrow; }
+
+	/** Wrap around safe, a client would need to play for years before it matters */
+	bool IsNewerThan(const FGoKartPackedMove& Other) const { return (int32)(Sequence - Other.Sequence) > 0; }
+
+	bool NetSerialize(FArchive& Ar, class UPackageMap* Map, bool& bOutSuccess);
+};
+
+template<>
+struct TStructOpsTypeTraits<FGoKartPackedMove> : public TStructOpsTypeTraitsBase2<FGoKartPackedMove>
+{
+	enum
+	{
+		WithNetSerializer = true
+	};
+};
+
+static_assert(sizeof(FGoKartPackedMove) == 8, "FGoKartPackedMove is meant to stay 8 bytes");
+
 
 UCLASS( ClassGroup=(Custom), meta=(BlueprintSpawnableComponent) )
 class KRAZYKARTS_API UGoKartMovementComponent : public UActorComponent
@@ -46,12 +110,55 @@ protected:
 	// Called when the game starts
 	virtual void BeginPlay() override;
 
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 public:	
 	// Called every frame
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 
+	/** Creates and simulates this frame's move, if we are the one in control. AGoKart calls it from its own tick, before replication.
+	Only whole simulation steps are simulated, so a frame shorter than the rest of a step creates no move at all */
+	void TickMovement(float DeltaTime);
+
+	/** Whether the last TickMovement created a move, i.e. GetLastMove has not been seen yet */
+	bool HasNewMove() const { return bHasNewMove; }
+
+	/** Adds DeltaTime to the time not simulated yet and takes out as many whole simulation steps as fit in it (s).
+	Everything that simulates in real time goes through here, so all of it runs in the steps the server cuts runs into */
+	float ConsumeSimulationSteps(float DeltaTime);
+
+	/** Drops the time that didn't fill a whole step yet, and the step to interpolate from, e.g. after a teleport */
+	void ResetSimulationSteps();
+
+	/** The pose between the last two simulation steps, by how much of the next step has passed. What the kart should be drawn at
+	when it moves in real time, else the kart would visibly stand still on frames that complete no step. Without that the actor's own pose */
+	FTransform GetInterpolatedTransform() const;
+
+	/** Caps the steps a single move may take, so a hitch never creates a move longer than the server accepts. The rest is caught up over the next frames */
+	void SetMaxStepsPerMove(int32 Val) { MaxStepsPerMove = FMath::Max(1, Val); }
+
+	/** MaxSimulationStep rounded down to FGoKartPackedMove's DeltaTime units, so a run of whole steps packs without loss */
+	int32 GetSimulationStepUnits() const;
+
+	float GetSimulationStep() const { return GetSimulationStepUnits() / FGoKartPackedMove::DeltaTimeUnitsPerSecond; }
+
 	void SimulateMove(const FGoKartMove& Move);
 
+	/** Simulates a run (one set of inputs held for Run.DeltaTime) in equal steps of at most one simulation step.
+	The client's own frames, its replay and the server all go through here, so a run of whole steps is cut into exactly those steps */
+	void SimulateRun(const FGoKartMove& Run);
+
+	/** SimulateRun for a move the server already simulated, replayed on top of a correction. The other karts are where they are now,
+	not where they were back then, so the replay neither collides with them nor pushes them around a second time */
+	void ReplayRun(const FGoKartMove& Run);
+
+	/** Runs the same force model as SimulateMove on a detached transform and velocity, without touching the actor or sweeping.
+	Used by the server to dead-reckon what the simulated proxies are extrapolating */
+	void PredictMove(const FGoKartMove& Move, FTransform& InOutTransform, FVector& InOutVelocity) const;
+
+	/** PredictMove in the same steps as SimulateRun */
+	void PredictRun(const FGoKartMove& Run, FTransform& InOutTransform, FVector& InOutVelocity) const;
+
 	FVector GetVelocity() { return Velocity; }
 	void SetVelocity(FVector Val) { Velocity = Val; }
 
@@ -60,17 +167,45 @@ public:
 
 	FGoKartMove GetLastMove() { return LastMove; }
 
+	float GetMass() const { return Mass; }
+	float GetCollisionRadius() const { return CollisionRadius; }
+	float GetRestitution() const { return Restitution; }
+
+	/** Only has an effect before BeginPlay */
+	void SetUseKartBroadphase(bool bVal) { bUseKartBroadphase = bVal; }
+
+	/** Logs accuracy and cost of every integrator in GoKartIntegrators.h on a straight run, at a range of step sizes */
+	static void RunIntegratorBenchmark();
+
 private:
 
 	FGoKartMove CreateMove(float DeltaTime);
 
-	FVector GetAirResistance();
+	/** How many steps SimulateRun and PredictRun cut a run of this length into */
+	int32 GetNumRunSteps(float DeltaTime) const;
+
+	/** The force model IntegrateMove steps: (DrivingForce + air and rolling resistance) / Mass, in m/s^2 */
+	FVector GetAcceleration(const FVector& DrivingForce, const FVector& AtVelocity, const FVector& Location) const;
+
+	FVector GetAirResistance(const FVector& InVelocity) const;
+
+	/** The world's gravity in m/s^2, or the project default without a world (the class default object in RunIntegratorBenchmark) */
+	float GetAccelerationDueToGravity() const;
 
-	FVector GetRollingResistance();
+	/** Scaled by the surface at Location, from the baked UGoKartSurfaceSubsystem grid */
+	FVector GetRollingResistance(const FVector& InVelocity, const FVector& Location) const;
 
-	void ApplyRotation(float DeltaTime, float InSteeringThrow);
+	FQuat GetRotationDelta(const FVector& Forward, const FVector& Up, const FVector& InVelocity, float DeltaTime, float InSteeringThrow) const;
 
-	void UpdateLocationFromVelocity(float DeltaTime);
+	/** One step of the force model with the given integrator (see GoKartIntegrators.h). Doesn't touch the actor,
+	SimulateMove and PredictMove only differ in what they do with the rotation and translation (cm) it returns */
+	template <typename TIntegrator>
+	void IntegrateMove(const FGoKartMove& Move, const FTransform& Transform, FVector& InOutVelocity, FQuat& OutRotationDelta, FVector& OutTranslation) const;
+
+	/** Sweeps the actor by Translation (cm), then resolves kart-vs-kart collisions */
+	void UpdateLocation(const FVector& Translation);
+
+	static constexpr float CentimetersPerMeter = 100.f; // The force model works in meters, the world in centimeters
 
 	// The mass of the car (kg)
 	UPROPERTY(EditAnywhere)
@@ -92,6 +227,22 @@ private:
 	UPROPERTY(EditAnywhere)
 	float RollingResistanceCoefficient = 0.015; // From wikipedia rolling resistance (0.01 to 0.015)
 
+	// Step (s) the kart is simulated in, by the client in real time and by the server when it replays the client's runs
+	UPROPERTY(EditAnywhere)
+	float MaxSimulationStep = 1.f / 60.f;
+
+	// Radius of the circle used for kart-vs-kart collisions (cm). Must stay below half of UGoKartCollisionSubsystem::CellSize
+	UPROPERTY(EditAnywhere)
+	float CollisionRadius = 150;
+
+	// How bouncy kart-vs-kart collisions are. 0 means the karts move together after impact, 1 is perfectly elastic
+	UPROPERTY(EditAnywhere)
+	float Restitution = 0.5;
+
+	// Resolve kart-vs-kart collisions in the broadphase grid, so the world sweep only has to consider static geometry
+	UPROPERTY(EditAnywhere)
+	bool bUseKartBroadphase = true;
+
 	FVector Velocity; // We keep this, but we keep it in sync with the server. So we replace that when we get the replicated state
 
 	float Throttle;
@@ -99,5 +250,25 @@ private:
 	float SteeringThrow;
 
 	FGoKartMove LastMove;
+
+	bool bHasNewMove = false;
+
+	bool bReplaying = false; // Set during ReplayRun
+
+	float UnsimulatedTime = 0; // Frame time that doesn't fill a whole simulation step yet (s)
+
+	int32 MaxStepsPerMove = MAX_int32;
+
+	FTransform PreviousStepTransform; // Actor transform before the last simulation step
+
+	bool bInterpolateSteps = false; // Set once the kart moves through ConsumeSimulationSteps
+
+	uint32 NextMoveSequence = 1; // 0 is what a default constructed ServerState acknowledges
+
+	UPROPERTY()
+	class UGoKartCollisionSubsystem* CollisionSubsystem;
+
+	UPROPERTY()
+	class UGoKartSurfaceSubsystem* SurfaceSubsystem;
 	
 };
@@ -3,6 +3,14 @@
 
 #include "GoKartMovementReplicator.h"
 #include "Net\UnrealNetwork.h"
+#include "Net\Core\PushModel\PushModel.h"
+#include "KrazyKarts.h"
+#include "GoKartSnapshotManager.h"
+#include "KrazyKartsOverloadSubsystem.h"
+#include "EngineUtils.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("ServerState Updates"), STAT_ServerStateUpdates, STATGROUP_KrazyKarts);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Dropped Client Moves"), STAT_DroppedClientMoves, STATGROUP_KrazyKarts);
 
 // Sets default values for this component's properties
 UGoKartMovementReplicator::UGoKartMovementReplicator()
@@ -21,14 +29,51 @@ void UGoKartMovementReplicator::BeginPlay()
 	Super::BeginPlay();
 
 	MovementComponent = GetOwner()->FindComponentByClass<UGoKartMovementComponent>();
-	
+	if (MovementComponent != nullptr)
+	{
+		MovementComponent->SetMaxStepsPerMove(GetMaxRunUnits() / MovementComponent->GetSimulationStepUnits());
+	}
+
+	if (GetOwnerRole() == ROLE_Authority)
+	{
+		TActorIterator<AGoKartSnapshotManager> It(GetWorld());
+		if (It)
+		{
+			SnapshotManager = *It;
+			SnapshotManager->RegisterKart(this, ServerState);
+		}
+
+		OverloadSubsystem = GetWorld()->GetSubsystem<UKrazyKartsOverloadSubsystem>();
+	}
+}
+
+void UGoKartMovementReplicator::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (SnapshotManager != nullptr)
+	{
+		SnapshotManager->UnregisterKart(this);
+		SnapshotManager = nullptr;
+	}
+
+	Super::EndPlay(EndPlayReason);
 }
 
 void UGoKartMovementReplicator::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
 {
 	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
 
-	DOREPLIFETIME(UGoKartMovementReplicator, ServerState); // This tells unreal that this variable should be replicated. Meaning when the client changes this value and replicates it, all the clients will get the updated value
+	// This tells unreal that this variable should be replicated. Meaning when the client changes this value and replicates it, all the clients will get the updated value.
+	// It is push based, so in builds with push model the net driver only compares it after UpdateServerState marked it dirty, instead of diffing it for every kart on every pass
+	FDoRepLifetimeParams Params;
+	Params.bIsPushBased = true;
+	DOREPLIFETIME_WITH_PARAMS_FAST(UGoKartMovementReplicator, ServerState, Params);
+}
+
+void UGoKartMovementReplicator::PreReplication(IRepChangedPropertyTracker& ChangedPropertyTracker)
+{
+	Super::PreReplication(ChangedPropertyTracker);
+
+	DOREPLIFETIME_ACTIVE_OVERRIDE(UGoKartMovementReplicator, ServerState, SnapshotManager == nullptr);
 }
 
 // Called every frame
@@ -36,86 +81,408 @@ void UGoKartMovementReplicator::TickComponent(float DeltaTime, ELevelTick TickTy
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 
+	TickReplication(DeltaTime);
+}
 
+void UGoKartMovementReplicator::TickReplication(float DeltaTime)
+{
 	if (MovementComponent == nullptr) return;
 
-	FGoKartMove LastMove = MovementComponent->GetLastMove();
+	FGoKartPackedMove LastMove = FGoKartPackedMove::Pack(MovementComponent->GetLastMove()); // Lossless, CreateMove already quantized it
+
+	// A frame that didn't complete a simulation step created no move
+	bool bHasNewMove = MovementComponent->HasNewMove();
 
 	// We are an AutonomousProxy, not a server
-	if (GetOwnerRole() == ROLE_AutonomousProxy)
+	if (GetOwnerRole() == ROLE_AutonomousProxy && bHasNewMove)
 	{
-		/* Add move to the queue and send it to the server (!!!) where
+		/* Add move to the run that gets sent to the server (!!!) where
 		   it would be simulated as Server-side ("Canonical" simulation) code */
 
-		UnacknowledgedMoves.Add(LastMove);
-		Server_SendMove(LastMove);
+		AddToPendingRun(LastMove);
 	}
 
 	/* Since all pawns show up as Authority when you're the server, we need to know whether we are the controlling pawn, or just the authority server and the pawn is controlled by someone else
 	 You could use GetRemoteRole() == ROLE_SimulatedProxy, which means you are not an AutonomousProxy on clients, which means you are the server, but this inconsistent, and it's better to use IsLocallyControlled */
-	if (GetOwner()->GetRemoteRole() == ROLE_SimulatedProxy) // This means we are the server, and the ones in control of this pawn.
+	if (GetOwner()->GetRemoteRole() == ROLE_SimulatedProxy && bHasNewMove) // This means we are the server, and the ones in control of this pawn.
 	{
 		UpdateServerState(LastMove);
 	}
 
+	// We are the server, and the pawn is controlled by a remote client
+	if (GetOwnerRole() == ROLE_Authority && GetOwner()->GetRemoteRole() == ROLE_AutonomousProxy)
+	{
+		SimulateBufferedMoves(DeltaTime);
+	}
+
 	// We need to simulate for the SimulatedProxy, because we weren't doing anything here, we were only setting the transform in OnRep_ServerState
 	if (GetOwnerRole() == ROLE_SimulatedProxy)
 	{
-		MovementComponent->SimulateMove(ServerState.LastMove); // WHY NOT CREATE A NEW MOVE?
+		// Extrapolate the last inputs over our own frame, not over the DeltaTime of the move that produced them.
+		// The server dead-reckons with the same model and the same steps to decide when ServerState needs updating
+		FGoKartMove ProxyMove = ServerState.LastMove.Unpack();
+		ProxyMove.DeltaTime = MovementComponent->ConsumeSimulationSteps(DeltaTime);
+		if (ProxyMove.DeltaTime > 0)
+		{
+			MovementComponent->SimulateRun(ProxyMove);
+		}
 	}
 
+	// Last, once the kart moved for this frame
+	UpdateMeshOffset(DeltaTime);
 }
 
-void UGoKartMovementReplicator::UpdateServerState(const FGoKartMove& Move)
+void UGoKartMovementReplicator::UpdateServerState(const FGoKartPackedMove& Move, bool bMoveComplete)
 {
+	TimeSinceServerStateUpdate += Move.GetDeltaTime();
+
+	// Dead-reckon over this move with the last replicated inputs, which is exactly what the simulated proxies are doing.
+	// A run spans many proxy frames, so it is cut into steps the way SimulateRun does it
+	FGoKartMove PredictionMove = ServerState.LastMove.Unpack();
+	PredictionMove.DeltaTime = Move.GetDeltaTime();
+	MovementComponent->PredictRun(PredictionMove, PredictedTransform, PredictedVelocity);
+
+	// Publishing now would acknowledge the whole run, and the client would replay the rest of it from the wrong place
+	if (!bMoveComplete) return;
+
+	const FTransform& ActualTransform = GetOwner()->GetActorTransform();
+
+	bool bInputChanged = !Move.HasSameInputs(ServerState.LastMove);
+	bool bLocationDiverged = FVector::DistSquared(ActualTransform.GetLocation(), PredictedTransform.GetLocation()) > FMath::Square(ReplicationLocationThreshold);
+	bool bRotationDiverged = ActualTransform.GetRotation().AngularDistance(PredictedTransform.GetRotation()) > FMath::DegreesToRadians(ReplicationRotationThreshold);
+
+	// While the prediction holds, leave ServerState alone so there is nothing new to send
+	if (!bInputChanged && !bLocationDiverged && !bRotationDiverged && !bForceServerStateUpdate && TimeSinceServerStateUpdate < MaxServerStateInterval) return;
+
 	ServerState.LastMove = Move;
-	ServerState.Transform = GetOwner()->GetActorTransform();
+	ServerState.Transform = ActualTransform;
 	ServerState.Velocity = MovementComponent->GetVelocity();
+
+	PublishServerState();
+	INC_DWORD_STAT(STAT_ServerStateUpdates);
+
+	PredictedTransform = ServerState.Transform;
+	PredictedVelocity = ServerState.Velocity;
+	TimeSinceServerStateUpdate = 0;
+	bForceServerStateUpdate = false;
+}
+
+void UGoKartMovementReplicator::PublishServerState()
+{
+	if (SnapshotManager != nullptr)
+	{
+		SnapshotManager->UpdateKart(this, ServerState);
+	}
+	else
+	{
+		MARK_PROPERTY_DIRTY_FROM_NAME(UGoKartMovementReplicator, ServerState, this);
+	}
+}
+
+void UGoKartMovementReplicator::ApplySnapshotState(const FGoKartState& State)
+{
+	if (GetOwnerRole() == ROLE_Authority) return; // A listen server already has the real state
+
+	ServerState = State;
+	OnRep_ServerState();
 }
 
 void UGoKartMovementReplicator::OnRep_ServerState()
 {
 	if (MovementComponent == nullptr) return;
 
+	if (MeshOffsetRoot == nullptr && GetOwnerRole() == ROLE_AutonomousProxy && !bWarnedNoMeshOffsetRoot)
+	{
+		UE_LOG(LogKrazyKarts, Warning, TEXT("%s has no mesh offset root, corrections will snap the whole kart. Call SetMeshOffsetRoot with its visual component"), *GetOwner()->GetName());
+		bWarnedNoMeshOffsetRoot = true;
+	}
+
+	// Remember where the visuals are, so the correction below only moves the collision root
+	FTransform VisualTransform;
+	if (MeshOffsetRoot != nullptr)
+	{
+		VisualTransform = MeshOffsetRoot->GetComponentTransform();
+	}
+
 	// Pseudo Step: Reset to server state
 	GetOwner()->SetActorTransform(ServerState.Transform);
 	MovementComponent->SetVelocity(ServerState.Velocity);
 
 	ClearAcknowledgeMoves(ServerState.LastMove);
 
-	for (const FGoKartMove& Move : UnacknowledgedMoves)
+	for (const FGoKartPackedMove& Move : UnacknowledgedMoves)
+	{
+		MovementComponent->ReplayRun(Move.Unpack()); // We cleared all the acknowledged moves, so we perform al the remaining unacknowledged ones
+	}
+
+	// The run still being extended was simulated locally too, it just hasn't gone out yet
+	if (bHasPendingRun)
+	{
+		MovementComponent->ReplayRun(PendingRun.Unpack());
+	}
+
+	if (MeshOffsetRoot == nullptr) return;
+
+	// Keep the visuals where they were, the offset this leaves behind is decayed in UpdateMeshOffset.
+	// Rest * Correction * Interpolated must give the old visual transform
+	FTransform Interpolated = MovementComponent->GetInterpolatedTransform();
+	FTransform RestWorld = MeshOffsetRootRestTransform * Interpolated;
+	if (FVector::DistSquared(VisualTransform.GetLocation(), RestWorld.GetLocation()) < FMath::Square(MaxSmoothedCorrection))
+	{
+		MeshCorrectionOffset = MeshOffsetRootRestTransform.Inverse() * VisualTransform.GetRelativeTransform(Interpolated);
+	}
+	else
+	{
+		MeshCorrectionOffset = FTransform::Identity;
+	}
+
+	ApplyMeshOffset();
+}
+
+void UGoKartMovementReplicator::ResetMovementState()
+{
+	UnacknowledgedMoves.Reset();
+	bHasPendingRun = false;
+	bHasSentRun = false;
+	ServerMoveBuffer.Reset();
+	ServerSimulationBudget = 0;
+	bServerMoveBufferPrimed = false;
+	bForceServerStateUpdate = false;
+	LastMoveArrivalTime = -1;
+	ArrivalJitter = 0;
+
+	if (MovementComponent != nullptr)
+	{
+		MovementComponent->SetVelocity(FVector::ZeroVector);
+		MovementComponent->ResetSimulationSteps();
+	}
+
+	if (GetOwnerRole() == ROLE_Authority)
+	{
+		ServerState = FGoKartState();
+		ServerState.Transform = GetOwner()->GetActorTransform();
+		PublishServerState();
+
+		PredictedTransform = ServerState.Transform;
+		PredictedVelocity = FVector::ZeroVector;
+		TimeSinceServerStateUpdate = 0;
+	}
+}
+
+void UGoKartMovementReplicator::SetMeshOffsetRoot(USceneComponent* Root)
+{
+	MeshOffsetRoot = Root;
+
+	if (MeshOffsetRoot != nullptr)
 	{
-		MovementComponent->SimulateMove(Move); // We cleared all the acknowledged moves, so we perform al the remaining unacknowledged ones
+		MeshOffsetRootRestTransform = MeshOffsetRoot->GetRelativeTransform();
 	}
 }
 
-void UGoKartMovementReplicator::ClearAcknowledgeMoves(FGoKartMove LastMove)
+void UGoKartMovementReplicator::UpdateMeshOffset(float DeltaTime)
 {
-	TArray<FGoKartMove> NewMoves;
+	if (MeshOffsetRoot == nullptr) return;
 
-	// Adding only newer moves
-	for (const FGoKartMove& Move : UnacknowledgedMoves)
+	if (!MeshCorrectionOffset.Equals(FTransform::Identity))
 	{
-		if (Move.Time > LastMove.Time)
+		float Alpha = 1 - FMath::Exp(-DeltaTime / FMath::Max(CorrectionSmoothingTime, KINDA_SMALL_NUMBER));
+
+		MeshCorrectionOffset.SetLocation(FMath::Lerp(MeshCorrectionOffset.GetLocation(), FVector::ZeroVector, Alpha));
+		MeshCorrectionOffset.SetRotation(FQuat::Slerp(MeshCorrectionOffset.GetRotation(), FQuat::Identity, Alpha));
+	}
+
+	ApplyMeshOffset();
+}
+
+void UGoKartMovementReplicator::ApplyMeshOffset()
+{
+	// The actor sits on the last simulation step, the visuals are drawn between it and the one before
+	FTransform StepOffset = MovementComponent->GetInterpolatedTransform().GetRelativeTransform(GetOwner()->GetActorTransform());
+	FTransform Relative = MeshOffsetRootRestTransform * MeshCorrectionOffset * StepOffset;
+
+	if (Relative.Equals(MeshOffsetRoot->GetRelativeTransform())) return; // Nothing changed, don't pay for a transform update
+
+	MeshOffsetRoot->SetRelativeLocationAndRotation(Relative.GetLocation(), Relative.GetRotation());
+}
+
+void UGoKartMovementReplicator::ClearAcknowledgeMoves(const FGoKartPackedMove& LastMove)
+{
+	// Moves are queued in sequence order, so the acknowledged ones are all at the front. Drop them in place
+	int32 NumAcknowledged = 0;
+	while (NumAcknowledged < UnacknowledgedMoves.Num() && !UnacknowledgedMoves[NumAcknowledged].IsNewerThan(LastMove))
+	{
+		++NumAcknowledged;
+	}
+
+	if (NumAcknowledged > 0)
+	{
+		UnacknowledgedMoves.RemoveAt(0, NumAcknowledged, false);
+	}
+}
+
+void UGoKartMovementReplicator::AddToPendingRun(const FGoKartPackedMove& Move)
+{
+	if (bHasPendingRun)
+	{
+		int32 RunUnits = PendingRun.DeltaTime + Move.DeltaTime;
+		if (Move.HasSameInputs(PendingRun) && RunUnits <= GetMaxRunUnits())
 		{
-			NewMoves.Add(Move);
+			PendingRun.DeltaTime = (uint16)RunUnits; // Both are already quantized, so the run is exactly as long as its frames
+			return;
 		}
+
+		SendPendingRun();
+	}
+
+	// The run keeps the sequence of its first frame, the sequences of the frames coalesced into it are simply never seen
+	PendingRun = Move;
+	bHasPendingRun = true;
+
+	// Don't make the server wait for new inputs, the rest of the run follows once it closes
+	if (!bHasSentRun || !Move.HasSameInputs(LastSentRun))
+	{
+		SendPendingRun();
 	}
+}
+
+void UGoKartMovementReplicator::SendPendingRun()
+{
+	UnacknowledgedMoves.Add(PendingRun);
+	Server_SendMove(PendingRun);
 
-	UnacknowledgedMoves = NewMoves;
+	LastSentRun = PendingRun;
+	bHasSentRun = true;
+	bHasPendingRun = false;
 }
 
-void UGoKartMovementReplicator::Server_SendMove_Implementation(FGoKartMove Move)
+void UGoKartMovementReplicator::SimulateBufferedMoves(float DeltaTime)
 {
 	if (MovementComponent == nullptr) return;
 
-	MovementComponent->SimulateMove(Move);
+	// With held inputs the client sends one run every MaxRunDuration, all of it time the buffer has to cover until the next one arrives.
+	// Without it every run would look like a late burst to catch up on, and the server would run dry in between
+	float TargetDepth = FMath::Clamp(ArrivalJitter * JitterBufferMultiplier, MinJitterBufferTime, MaxJitterBufferTime) + MaxRunDuration;
+
+	float BufferedTime = 0;
+	for (const FGoKartPackedMove& Move : ServerMoveBuffer)
+	{
+		BufferedTime += Move.GetDeltaTime();
+	}
+
+	if (!bServerMoveBufferPrimed)
+	{
+		if (BufferedTime < TargetDepth) return;
+		bServerMoveBufferPrimed = true;
+	}
+
+	ServerSimulationBudget += DeltaTime;
+
+	// A burst of late moves left us well behind the target, so catch up instead of staying that much in the past
+	if (BufferedTime - ServerSimulationBudget > 2 * TargetDepth)
+	{
+		ServerSimulationBudget = BufferedTime - TargetDepth;
+	}
+
+	int32 MaxSteps = OverloadSubsystem != nullptr ? OverloadSubsystem->GetMaxStepsPerServerTick(MaxStepsPerServerTick) : MaxStepsPerServerTick;
+
+	// Runs are released a whole simulation step at a time, so the server keeps advancing every tick instead of in run sized bursts.
+	// The client simulated the same steps, so where a run is split doesn't change the result
+	int32 StepUnits = MovementComponent->GetSimulationStepUnits();
+	int32 BudgetUnits = FMath::FloorToInt(ServerSimulationBudget * FGoKartPackedMove::DeltaTimeUnitsPerSecond + KINDA_SMALL_NUMBER);
+
+	int32 Released = 0;
+	int32 StepsLeft = MaxSteps;
+	while (Released < ServerMoveBuffer.Num() && StepsLeft > 0)
+	{
+		FGoKartPackedMove& Run = ServerMoveBuffer[Released];
+
+		// A run that isn't made of whole steps (only the last piece of it can be shorter) is finished as soon as the budget covers it
+		int32 AllowedUnits = FMath::Min(BudgetUnits, StepsLeft * StepUnits);
+		int32 Units = Run.DeltaTime <= AllowedUnits ? Run.DeltaTime : (AllowedUnits / StepUnits) * StepUnits;
+		if (Units <= 0) break;
+
+		FGoKartPackedMove Part = Run;
+		Part.DeltaTime = (uint16)Units;
+		MovementComponent->SimulateRun(Part.Unpack());
+		ServerSimulationBudget -= Part.GetDeltaTime();
+		BudgetUnits -= Units;
+		StepsLeft -= FMath::DivideAndRoundUp(Units, StepUnits);
+
+		Run.DeltaTime -= Units; // The rest of the run stays at the head of the buffer
+		bool bRunComplete = Run.DeltaTime == 0;
+		UpdateServerState(Part, bRunComplete);
+		if (bRunComplete)
+		{
+			++Released;
+		}
+	}
+
+	if (Released > 0)
+	{
+		ServerMoveBuffer.RemoveAt(0, Released, false);
+	}
+
+	// Ran dry, the client is sending slower than we simulate. Time owed beyond a step is forgotten rather than caught up in a burst
+	// once moves arrive again, but the buffer stays primed so the next ones are released right away instead of after a refill
+	if (ServerMoveBuffer.Num() == 0)
+	{
+		ServerSimulationBudget = FMath::Min(ServerSimulationBudget, MovementComponent->GetSimulationStep());
+	}
+}
+
+void UGoKartMovementReplicator::TrimServerMoveBuffer()
+{
+	float MaxBufferedTime = MaxJitterBufferTime + MaxRunDuration + MaxBufferedTimeMargin;
+
+	float BufferedTime = 0;
+	for (const FGoKartPackedMove& Move : ServerMoveBuffer)
+	{
+		BufferedTime += Move.GetDeltaTime();
+	}
+
+	int32 NumDropped = 0;
+	while (BufferedTime > MaxBufferedTime && NumDropped < ServerMoveBuffer.Num() - 1)
+	{
+		BufferedTime -= ServerMoveBuffer[NumDropped].GetDeltaTime();
+		++NumDropped;
+	}
+
+	if (NumDropped == 0) return;
+
+	ServerMoveBuffer.RemoveAt(0, NumDropped, false);
+	bForceServerStateUpdate = true;
+	INC_DWORD_STAT_BY(STAT_DroppedClientMoves, NumDropped);
+}
+
+int32 UGoKartMovementReplicator::GetMaxRunUnits() const
+{
+	return FMath::Clamp(FMath::RoundToInt(MaxRunDuration * FGoKartPackedMove::DeltaTimeUnitsPerSecond), 1, (int32)MAX_uint16);
+}
+
+void UGoKartMovementReplicator::MeasureArrivalJitter(const FGoKartPackedMove& Move)
+{
+	float Now = GetWorld()->GetRealTimeSeconds();
+
+	if (LastMoveArrivalTime >= 0)
+	{
+		float Deviation = FMath::Abs((Now - LastMoveArrivalTime) - Move.GetDeltaTime());
+		ArrivalJitter = FMath::Lerp(ArrivalJitter, Deviation, 0.1f);
+	}
+
+	LastMoveArrivalTime = Now;
+}
+
+void UGoKartMovementReplicator::Server_SendMove_Implementation(FGoKartPackedMove Move)
+{
+	MeasureArrivalJitter(Move);
 
-	UpdateServerState(Move);
+	ServerMoveBuffer.Add(Move); // Simulated later in SimulateBufferedMoves, on the server's own tick
+	TrimServerMoveBuffer();
 }
 
-bool UGoKartMovementReplicator::Server_SendMove_Validate(FGoKartMove Move)
+bool UGoKartMovementReplicator::Server_SendMove_Validate(FGoKartPackedMove Move)
 {
-	return true; // TODO: Make better validation
+	// The client never closes a run longer than this, and an empty one would sit at the head of the buffer forever
+	return Move.DeltaTime > 0 && Move.DeltaTime <= GetMaxRunUnits();
 }
 
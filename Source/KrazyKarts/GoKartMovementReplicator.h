@@ -7,6 +7,10 @@
 #include "GoKartMovementComponent.h"
 #include "GoKartMovementReplicator.generated.h"
 
+class USceneComponent;
+class AGoKartSnapshotManager;
+class UKrazyKartsOverloadSubsystem;
+
 
 USTRUCT()
 struct FGoKartState
@@ -25,7 +29,7 @@ struct FGoKartState
 	We are going to need the throttle in order to interpolate.
 	This is the last move that went into making this state */
 	UPROPERTY()
-	FGoKartMove LastMove;
+	FGoKartPackedMove LastMove;
 };
 
 UCLASS( ClassGroup=(Custom), meta=(BlueprintSpawnableComponent) )
@@ -41,22 +45,72 @@ protected:
 	// Called when the game starts
 	virtual void BeginPlay() override;
 
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 public:	
 
 	void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
 
+	/** ServerState stays off the actor channel while an AGoKartSnapshotManager replicates it */
+	virtual void PreReplication(IRepChangedPropertyTracker& ChangedPropertyTracker) override;
+
 	// Called every frame
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 
+	/** Sends, buffers or extrapolates moves depending on our role. Must run after the movement component created this frame's move */
+	void TickReplication(float DeltaTime);
+
+	/** The component holding the kart's visuals (mesh, and the camera if it is attached below it).
+	On a correction the root snaps to the server pose, while this component keeps its old world pose and is eased back */
+	UFUNCTION(BlueprintCallable)
+	void SetMeshOffsetRoot(USceneComponent* Root);
+
+	/** Forgets all moves and replicated state, for when the kart is reused for another player */
+	void ResetMovementState();
+
+	/** Client side. Takes a state from the snapshot manager and handles it like a replicated ServerState */
+	void ApplySnapshotState(const FGoKartState& State);
+
 private:
 
-	void ClearAcknowledgeMoves(FGoKartMove LastMove);
+	/** Hands the ServerState to the network, either through our own property or through the snapshot manager */
+	void PublishServerState();
+
+	void ClearAcknowledgeMoves(const FGoKartPackedMove& LastMove);
+
+	/** Client side. Extends the pending run with this frame's move, or closes it and starts a new one when the inputs changed */
+	void AddToPendingRun(const FGoKartPackedMove& Move);
+
+	/** Client side. Queues the pending run as unacknowledged and sends it to the server */
+	void SendPendingRun();
+
+	/** Dead-reckons over Move and publishes ServerState when the proxies would be off. Only a complete move may be published,
+	since ServerState acknowledges the move it ends with */
+	void  UpdateServerState(const FGoKartPackedMove& Move, bool bMoveComplete = true);
+
+	/** Releases buffered client moves on the server tick, instead of simulating them whenever the RPC happens to arrive.
+	A run may be split over several ticks, in whole simulation steps */
+	void SimulateBufferedMoves(float DeltaTime);
+
+	/** Drops the oldest buffered moves once the buffer holds more client time than MaxBufferedTime. The client gets
+	corrected, since the server never simulated them, instead of the buffer and the latency growing without limit */
+	void TrimServerMoveBuffer();
 
-	void  UpdateServerState(const FGoKartMove& Move);
+	/** Longest run the client sends and the server accepts, in FGoKartPackedMove DeltaTime units */
+	int32 GetMaxRunUnits() const;
+
+	/** Smooths the difference between when a move arrived and when it should have arrived, judging by the client's DeltaTime */
+	void MeasureArrivalJitter(const FGoKartPackedMove& Move);
+
+	/** Exponentially decays what is left of the last correction, then places the MeshOffsetRoot */
+	void UpdateMeshOffset(float DeltaTime);
+
+	/** Puts the MeshOffsetRoot at the interpolated simulation pose, offset by the correction still being hidden */
+	void ApplyMeshOffset();
 
 	/** Reliable server RPC function */
 	UFUNCTION(Server, Reliable, WithValidation)
-	void Server_SendMove(FGoKartMove Move);
+	void Server_SendMove(FGoKartPackedMove Move);
 
 	UPROPERTY(ReplicatedUsing = OnRep_ServerState)
 	FGoKartState ServerState; // We replicate this as it holds all the information
@@ -68,8 +122,105 @@ private:
 	UFUNCTION()
 	void OnRep_ServerState();
 
-	TArray<FGoKartMove> UnacknowledgedMoves; // only on the client
+	// Inline, so steady driving never allocates. Runs keep the queue short, it only spills to the heap on a long stall
+	TArray<FGoKartPackedMove, TInlineAllocator<32>> UnacknowledgedMoves; // only on the client, runs sent but not acknowledged yet
+
+	FGoKartPackedMove PendingRun; // only on the client, the run still being extended. Simulated locally but not sent yet
+
+	bool bHasPendingRun = false;
+
+	FGoKartPackedMove LastSentRun; // only on the client, to tell whether a new run changes the inputs
+
+	bool bHasSentRun = false;
+
+	TArray<FGoKartPackedMove, TInlineAllocator<16>> ServerMoveBuffer; // only on the server, moves received but not simulated yet
+
+	// Simulation time the server tick still owes this kart. Moves are released while they fit in it
+	float ServerSimulationBudget = 0;
+
+	// Set when moves were dropped, so the next ServerState goes out and corrects the client even if the proxies' prediction holds
+	bool bForceServerStateUpdate = false;
+
+	// The buffer first fills up to its target depth before anything is released
+	bool bServerMoveBufferPrimed = false;
+
+	float LastMoveArrivalTime = -1;
+
+	float ArrivalJitter = 0; // Smoothed arrival jitter of the client's moves (s)
+
+	/** Only on the server. Where the simulated proxies think the kart is, extrapolated from the last ServerState the same way they do it */
+	FTransform PredictedTransform;
+
+	FVector PredictedVelocity;
+
+	float TimeSinceServerStateUpdate = 0;
+
+	// ServerState is only updated once the dead-reckoned position is off by more than this (cm)
+	UPROPERTY(EditAnywhere)
+	float ReplicationLocationThreshold = 20;
+
+	// ServerState is only updated once the dead-reckoned rotation is off by more than this (degrees)
+	UPROPERTY(EditAnywhere)
+	float ReplicationRotationThreshold = 5;
+
+	// Forces an update after this long (s) even if the prediction holds, the owning client needs it to acknowledge its moves
+	UPROPERTY(EditAnywhere)
+	float MaxServerStateInterval = 1;
+
+	// How many times the measured jitter the server keeps buffered. Higher means smoother, but adds latency
+	UPROPERTY(EditAnywhere)
+	float JitterBufferMultiplier = 2;
+
+	// Lower bound of the buffer depth (s)
+	UPROPERTY(EditAnywhere)
+	float MinJitterBufferTime = 0.02;
+
+	// Upper bound of the buffer depth (s)
+	UPROPERTY(EditAnywhere)
+	float MaxJitterBufferTime = 0.2;
+
+	// Limits the CPU a single kart can take in one server frame, even while catching up. Counted in simulation steps, however long the runs are
+	UPROPERTY(EditAnywhere)
+	int32 MaxStepsPerServerTick = 24;
+
+	// Longest run (s) the client coalesces frames with unchanged inputs into before sending it.
+	// Input changes always go out on the frame they happen, this only bounds how late the server hears that they didn't change
+	UPROPERTY(EditAnywhere)
+	float MaxRunDuration = 0.1;
+
+	// Client time (s) the server buffers beyond MaxJitterBufferTime and a run before it drops the oldest moves.
+	// Only a client sending faster than real time, or a server that can't keep up, gets there
+	UPROPERTY(EditAnywhere)
+	float MaxBufferedTimeMargin = 0.1;
 
 	UPROPERTY()
 	UGoKartMovementComponent* MovementComponent;
+
+	UPROPERTY()
+	USceneComponent* MeshOffsetRoot;
+
+	// Only on the server, set when the game mode runs the snapshot replication mode
+	UPROPERTY()
+	AGoKartSnapshotManager* SnapshotManager;
+
+	// Only on the server, caps MaxStepsPerServerTick while the server is overloaded
+	UPROPERTY()
+	UKrazyKartsOverloadSubsystem* OverloadSubsystem;
+
+	bool bWarnedNoMeshOffsetRoot = false; // So the missing root is only reported once per kart
+
+	FTransform MeshOffsetRootRestTransform; // Relative transform of the MeshOffsetRoot when there is no correction to hide
+
+	FTransform MeshCorrectionOffset; // Part of a correction not shown yet, relative to the interpolated pose
+
+	// Time constant of the correction smoothing (s). After this long about 63% of the visual error is gone
+	UPROPERTY(EditAnywhere)
+	float CorrectionSmoothingTime = 0.1;
+
+	// Corrections further than this (cm) are snapped, smoothing them would just look like the kart is sliding
+	UPROPERTY(EditAnywhere)
+	float MaxSmoothedCorrection = 500;
+
+	// Plays client and server to each other without a net driver, see Tests/GoKartTickAllocationTest.cpp
+	friend class FGoKartTickAllocationTest;
 };
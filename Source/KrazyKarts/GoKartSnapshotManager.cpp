@@ -0,0 +1,177 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartSnapshotManager.h"
+#include "KrazyKarts.h"
+#include "Net\UnrealNetwork.h"
+#include "Serialization/BitWriter.h"
+#include "HAL/IConsoleManager.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Snapshot Entries Updated"), STAT_SnapshotEntriesUpdated, STATGROUP_KrazyKarts);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Snapshot Karts"), STAT_SnapshotKarts, STATGROUP_KrazyKarts);
+
+static FAutoConsoleCommand BenchmarkSnapshotCommand(
+	TEXT("KrazyKarts.BenchmarkSnapshot"),
+	TEXT("KrazyKarts.BenchmarkSnapshot <Karts> <ChangedKarts> <BunchOverheadBits>. Compares bytes per tick of snapshot and per kart replication"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		int32 NumKarts = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 32;
+		int32 NumChanged = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : NumKarts;
+		int32 BunchOverheadBits = Args.Num() > 2 ? FCString::Atoi(*Args[2]) : 64;
+		AGoKartSnapshotManager::RunBenchmark(FMath::Max(1, NumKarts), FMath::Clamp(NumChanged, 0, FMath::Max(1, NumKarts)), FMath::Max(0, BunchOverheadBits));
+	}));
+
+void FGoKartSnapshotEntry::SetState(const FGoKartState& State)
+{
+	Location = State.Transform.GetLocation();
+	Rotation = State.Transform.Rotator();
+	Velocity = State.Velocity;
+	LastMove = State.LastMove;
+}
+
+FGoKartState FGoKartSnapshotEntry::GetState() const
+{
+	FGoKartState State;
+	State.Transform = FTransform(Rotation, Location);
+	State.Velocity = Velocity;
+	State.LastMove = LastMove;
+	return State;
+}
+
+void FGoKartSnapshotEntry::PostReplicatedAdd(const FGoKartSnapshot& InArraySerializer)
+{
+	PostReplicatedChange(InArraySerializer);
+}
+
+void FGoKartSnapshotEntry::PostReplicatedChange(const FGoKartSnapshot& InArraySerializer)
+{
+	if (Replicator == nullptr) return; // The kart itself hasn't replicated yet
+
+	Replicator->ApplySnapshotState(GetState());
+}
+
+AGoKartSnapshotManager::AGoKartSnapshotManager()
+{
+	bReplicates = true;
+	bAlwaysRelevant = true;
+
+	NetUpdateFrequency = 30; // One snapshot per server tick at 30 Hz, whatever the kart count
+}
+
+void AGoKartSnapshotManager::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	DOREPLIFETIME(AGoKartSnapshotManager, Snapshot);
+}
+
+void AGoKartSnapshotManager::RegisterKart(UGoKartMovementReplicator* Replicator, const FGoKartState& State)
+{
+	if (Replicator == nullptr || EntryIndices.Contains(Replicator)) return;
+
+	FGoKartSnapshotEntry& Entry = Snapshot.Entries.AddDefaulted_GetRef();
+	Entry.Replicator = Replicator;
+	Entry.SetState(State);
+	Snapshot.MarkItemDirty(Entry);
+
+	EntryIndices.Add(Replicator, Snapshot.Entries.Num() - 1);
+	SET_DWORD_STAT(STAT_SnapshotKarts, Snapshot.Entries.Num());
+}
+
+void AGoKartSnapshotManager::UnregisterKart(UGoKartMovementReplicator* Replicator)
+{
+	int32 Index;
+	if (!EntryIndices.RemoveAndCopyValue(Replicator, Index)) return;
+
+	Snapshot.Entries.RemoveAtSwap(Index);
+	if (Snapshot.Entries.IsValidIndex(Index))
+	{
+		EntryIndices[Snapshot.Entries[Index].Replicator] = Index; // The last entry was swapped into the gap
+	}
+	Snapshot.MarkArrayDirty();
+
+	SET_DWORD_STAT(STAT_SnapshotKarts, Snapshot.Entries.Num());
+}
+
+void AGoKartSnapshotManager::UpdateKart(UGoKartMovementReplicator* Replicator, const FGoKartState& State)
+{
+	const int32* Index = EntryIndices.Find(Replicator);
+	if (Index == nullptr) return;
+
+	FGoKartSnapshotEntry& Entry = Snapshot.Entries[*Index];
+	Entry.SetState(State);
+	Snapshot.MarkItemDirty(Entry);
+
+	INC_DWORD_STAT(STAT_SnapshotEntriesUpdated);
+}
+
+void AGoKartSnapshotManager::RunBenchmark(int32 NumKarts, int32 NumChanged, int32 BunchOverheadBits)
+{
+	FRandomStream Random(NumKarts);
+
+	TArray<FGoKartState> States;
+	for (int32 i = 0; i < NumKarts; ++i)
+	{
+		FGoKartState& State = States.AddDefaulted_GetRef();
+		State.Transform = FTransform(FRotator(0.f, Random.FRandRange(-180.f, 180.f), 0.f), FVector(Random.FRandRange(-50000.f, 50000.f), Random.FRandRange(-50000.f, 50000.f), Random.FRandRange(0.f, 2000.f)));
+		State.Velocity = Random.GetUnitVector() * Random.FRandRange(0.f, 20.f);
+		State.LastMove.Throttle = (int8)Random.RandRange(-127, 127);
+		State.LastMove.SteeringThrow = (int8)Random.RandRange(-127, 127);
+		State.LastMove.DeltaTime = (uint16)Random.RandRange(500, 6400); // Up to a 0.1 s run
+		State.LastMove.Sequence = Random.RandRange(0, MAX_int32);
+	}
+
+	bool bOutSuccess = false;
+
+	// Per kart: the rep layout sends each changed leaf property of ServerState behind a packed handle, in its own bunch
+	FBitWriter PerKart(0, true);
+	for (int32 i = 0; i < NumChanged; ++i)
+	{
+		FGoKartState& State = States[i];
+		FQuat Rotation = State.Transform.GetRotation();
+		FVector Translation = State.Transform.GetTranslation();
+		FVector Scale = State.Transform.GetScale3D();
+
+		uint32 Handle = 1;
+		PerKart.SerializeIntPacked(Handle);
+		Rotation.NetSerialize(PerKart, nullptr, bOutSuccess);
+		PerKart.SerializeIntPacked(Handle);
+		PerKart << Translation;
+		PerKart.SerializeIntPacked(Handle);
+		PerKart << Scale;
+		PerKart.SerializeIntPacked(Handle);
+		PerKart << State.Velocity;
+		PerKart.SerializeIntPacked(Handle);
+		State.LastMove.NetSerialize(PerKart, nullptr, bOutSuccess);
+
+		uint32 EndHandle = 0;
+		PerKart.SerializeIntPacked(EndHandle);
+	}
+	int64 PerKartBits = PerKart.GetNumBits() + (int64)NumChanged * BunchOverheadBits;
+
+	// Snapshot: the fast array header, then the ID and every property of each changed entry, in a single bunch
+	FBitWriter SnapshotWriter(0, true);
+	int32 ArrayReplicationKey = 1;
+	int32 BaseReplicationKey = 0;
+	int32 NumDeletes = 0;
+	int32 NumChangedItems = NumChanged;
+	SnapshotWriter << ArrayReplicationKey << BaseReplicationKey << NumDeletes << NumChangedItems;
+	for (int32 i = 0; i < NumChanged; ++i)
+	{
+		FGoKartSnapshotEntry Entry;
+		Entry.SetState(States[i]);
+
+		int32 ReplicationID = i;
+		uint32 ReplicatorGUID = 2 * (i + 1); // Already acknowledged, so only the packed NetGUID
+		SnapshotWriter << ReplicationID;
+		SnapshotWriter.SerializeIntPacked(ReplicatorGUID);
+		Entry.Location.NetSerialize(SnapshotWriter, nullptr, bOutSuccess);
+		Entry.Rotation.NetSerialize(SnapshotWriter, nullptr, bOutSuccess);
+		Entry.Velocity.NetSerialize(SnapshotWriter, nullptr, bOutSuccess);
+		Entry.LastMove.NetSerialize(SnapshotWriter, nullptr, bOutSuccess);
+	}
+	int64 SnapshotBits = SnapshotWriter.GetNumBits() + BunchOverheadBits;
+
+	UE_LOG(LogKrazyKarts, Log, TEXT("Snapshot benchmark, %d of %d karts changed, %d bits per bunch header: per kart %lld bytes/tick (%lld bytes/s at 30 Hz), snapshot %lld bytes/tick (%lld bytes/s at 30 Hz)"),
+		NumChanged, NumKarts, BunchOverheadBits, (PerKartBits + 7) / 8, (PerKartBits + 7) / 8 * 30, (SnapshotBits + 7) / 8, (SnapshotBits + 7) / 8 * 30);
+}
@@ -0,0 +1,101 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Info.h"
+#include "Engine/NetSerialization.h"
+#include "GoKartMovementReplicator.h"
+#include "GoKartSnapshotManager.generated.h"
+
+struct FGoKartSnapshot;
+
+/** One kart in the snapshot. A compact FGoKartState: quantized location and velocity, compressed rotation and the packed move */
+USTRUCT()
+struct FGoKartSnapshotEntry : public FFastArraySerializerItem
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	UGoKartMovementReplicator* Replicator = nullptr;
+
+	UPROPERTY()
+	FVector_NetQuantize100 Location;
+
+	UPROPERTY()
+	FRotator Rotation; // Replicated as compressed shorts
+
+	UPROPERTY()
+	FVector_NetQuantize100 Velocity;
+
+	UPROPERTY()
+	FGoKartPackedMove LastMove;
+
+	void SetState(const FGoKartState& State);
+
+	FGoKartState GetState() const;
+
+	/** Feed the state to the kart like OnRep_ServerState would */
+	void PostReplicatedAdd(const FGoKartSnapshot& InArraySerializer);
+	void PostReplicatedChange(const FGoKartSnapshot& InArraySerializer);
+};
+
+/** All karts in one array. Only the entries that changed since the last snapshot a connection acknowledged are sent to it */
+USTRUCT()
+struct FGoKartSnapshot : public FFastArraySerializer
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	TArray<FGoKartSnapshotEntry> Entries;
+
+	bool NetDeltaSerialize(FNetDeltaSerializeInfo& DeltaParms)
+	{
+		return FFastArraySerializer::FastArrayDeltaSerialize<FGoKartSnapshotEntry, FGoKartSnapshot>(Entries, DeltaParms, *this);
+	}
+};
+
+template<>
+struct TStructOpsTypeTraits<FGoKartSnapshot> : public TStructOpsTypeTraitsBase2<FGoKartSnapshot>
+{
+	enum
+	{
+		WithNetDeltaSerializer = true
+	};
+};
+
+/**
+ * Optional replication path for many karts. Instead of every UGoKartMovementReplicator replicating its own ServerState,
+ * they hand it to this actor, which replicates one snapshot of all karts at its own NetUpdateFrequency.
+ * Spawned by AKrazyKartsGameMode when bUseSnapshotReplication is set.
+ */
+UCLASS()
+class KRAZYKARTS_API AGoKartSnapshotManager : public AInfo
+{
+	GENERATED_BODY()
+
+public:
+	AGoKartSnapshotManager();
+
+	void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+
+	/** Server only */
+	void RegisterKart(UGoKartMovementReplicator* Replicator, const FGoKartState& State);
+
+	/** Server only */
+	void UnregisterKart(UGoKartMovementReplicator* Replicator);
+
+	/** Server only. Marks the kart's entry dirty so it goes out with the next snapshot */
+	void UpdateKart(UGoKartMovementReplicator* Replicator, const FGoKartState& State);
+
+	/** Logs the bytes one server tick sends a connection when NumChanged of NumKarts karts changed, through the snapshot and through
+	per kart ServerState replication. Payloads are written with the serializers the net driver uses, bunch headers are BunchOverheadBits each */
+	static void RunBenchmark(int32 NumKarts, int32 NumChanged, int32 BunchOverheadBits);
+
+private:
+
+	UPROPERTY(Replicated)
+	FGoKartSnapshot Snapshot;
+
+	TMap<UGoKartMovementReplicator*, int32> EntryIndices;
+};
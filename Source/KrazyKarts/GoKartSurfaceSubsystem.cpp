@@ -0,0 +1,243 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartSurfaceSubsystem.h"
+#include "KrazyKarts.h"
+#include "KrazyKartsMatchSubsystem.h"
+#include "Engine/World.h"
+#include "Engine/LevelBounds.h"
+#include "PhysicalMaterials/PhysicalMaterial.h"
+#include "HAL/PlatformFileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+DECLARE_CYCLE_STAT(TEXT("Surface Grid Bake"), STAT_SurfaceGridBake, STATGROUP_KrazyKarts);
+
+#if WITH_EDITOR
+static FAutoConsoleCommandWithWorld BakeSurfaceGridCommand(
+	TEXT("KrazyKarts.BakeSurfaceGrid"),
+	TEXT("Traces the map and the streamed in match track into new surface grids and saves them to Content/SurfaceGrids"),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		UGoKartSurfaceSubsystem* SurfaceSubsystem = World != nullptr ? World->GetSubsystem<UGoKartSurfaceSubsystem>() : nullptr;
+		if (SurfaceSubsystem != nullptr)
+		{
+			SurfaceSubsystem->BakeAndSave();
+		}
+	}));
+#endif
+
+void UGoKartSurfaceSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	MatchSubsystem = Cast<UKrazyKartsMatchSubsystem>(Collection.InitializeDependency(UKrazyKartsMatchSubsystem::StaticClass()));
+
+	for (float& Scale : RollingResistanceScales)
+	{
+		Scale = 1;
+	}
+
+	for (const FGoKartSurfaceRollingResistance& Entry : SurfaceRollingResistance)
+	{
+		RollingResistanceScales[Entry.Surface] = Entry.Scale;
+	}
+}
+
+void UGoKartSurfaceSubsystem::Deinitialize()
+{
+	LevelGrid.Unload();
+	MatchTrackGrid.Unload();
+
+	Super::Deinitialize();
+}
+
+void UGoKartSurfaceSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	FString Filename = GetGridFilename(UWorld::RemovePIEPrefix(InWorld.GetMapName()));
+	if (!LevelGrid.Load(Filename))
+	{
+		UE_LOG(LogKrazyKarts, Warning, TEXT("No surface grid at %s, every surface uses the default friction. KrazyKarts.BakeSurfaceGrid bakes it"), *Filename);
+	}
+
+	if (MatchSubsystem == nullptr || MatchSubsystem->MatchCount <= 1 || MatchSubsystem->MatchTrackLevel.IsNull()) return;
+
+	Filename = GetGridFilename(MatchSubsystem->MatchTrackLevel.GetAssetName());
+	if (!MatchTrackGrid.Load(Filename))
+	{
+		UE_LOG(LogKrazyKarts, Warning, TEXT("No surface grid at %s, every surface of the match tracks uses the default friction"), *Filename);
+	}
+}
+
+FGoKartSurfaceCell UGoKartSurfaceSubsystem::GetSurface(const FVector& Location) const
+{
+	// Every match after the first races on an instance of the match track, MatchSpacing further along Y
+	int32 MatchId = MatchSubsystem != nullptr ? MatchSubsystem->GetMatchAtLocation(Location) : 0;
+	if (MatchId > 0) return MatchTrackGrid.GetSurface(Location - MatchSubsystem->GetMatchOrigin(MatchId));
+
+	return LevelGrid.GetSurface(Location);
+}
+
+FGoKartSurfaceCell UGoKartSurfaceSubsystem::FGrid::GetSurface(const FVector& Location) const
+{
+	if (Cells == nullptr) return FGoKartSurfaceCell();
+
+	int32 X = FMath::FloorToInt((Location.X - Header.OriginX) / Header.CellSize);
+	int32 Y = FMath::FloorToInt((Location.Y - Header.OriginY) / Header.CellSize);
+	if (X < 0 || Y < 0 || X >= Header.Width || Y >= Header.Height) return FGoKartSurfaceCell();
+
+	return Cells[Y * Header.Width + X];
+}
+
+FString UGoKartSurfaceSubsystem::GetGridFilename(const FString& LevelName) const
+{
+	return FPaths::ProjectContentDir() / TEXT("SurfaceGrids") / LevelName + TEXT(".kksurf");
+}
+
+bool UGoKartSurfaceSubsystem::FGrid::Load(const FString& Filename)
+{
+	Unload();
+
+	MappedFile.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Filename));
+	if (!MappedFile.IsValid()) return false;
+
+	if (MappedFile->GetFileSize() >= (int64)sizeof(FGridHeader))
+	{
+		MappedRegion.Reset(MappedFile->MapRegion());
+	}
+
+	if (MappedRegion.IsValid())
+	{
+		FMemory::Memcpy(&Header, MappedRegion->GetMappedPtr(), sizeof(FGridHeader));
+
+		int64 ExpectedSize = sizeof(FGridHeader) + (int64)Header.Width * Header.Height * sizeof(FGoKartSurfaceCell);
+		if (Header.Magic == GridMagic && Header.Version == GridVersion && Header.CellSize > 0 && Header.Width > 0 && Header.Height > 0 && MappedRegion->GetMappedSize() >= ExpectedSize)
+		{
+			Cells = reinterpret_cast<const FGoKartSurfaceCell*>(MappedRegion->GetMappedPtr() + sizeof(FGridHeader));
+			return true;
+		}
+	}
+
+	UE_LOG(LogKrazyKarts, Warning, TEXT("Surface grid %s is invalid or from another version"), *Filename);
+	Unload();
+	return false;
+}
+
+void UGoKartSurfaceSubsystem::FGrid::Unload()
+{
+	Cells = nullptr;
+	BakedCells.Empty();
+	MappedRegion.Reset(); // The region has to go before the file it maps
+	MappedFile.Reset();
+}
+
+void UGoKartSurfaceSubsystem::BakeAndSave()
+{
+	UWorld* World = GetWorld();
+
+	// Streamed match tracks are MatchSpacing apart, one box around all of them would be mostly empty cells
+	FBox LevelBounds(ForceInit);
+	FBox TrackBounds(ForceInit);
+	int32 TrackMatchId = INDEX_NONE;
+	for (ULevel* Level : World->GetLevels())
+	{
+		int32 MatchId = MatchSubsystem != nullptr ? MatchSubsystem->GetLevelMatch(Level) : INDEX_NONE;
+		if (MatchId == INDEX_NONE)
+		{
+			LevelBounds += ALevelBounds::CalculateLevelBounds(Level);
+		}
+		else if (TrackMatchId == INDEX_NONE)
+		{
+			TrackMatchId = MatchId;
+			TrackBounds = ALevelBounds::CalculateLevelBounds(Level);
+		}
+	}
+
+	if (LevelBounds.IsValid)
+	{
+		Bake(LevelGrid, LevelBounds, FVector::ZeroVector);
+		LevelGrid.Save(GetGridFilename(UWorld::RemovePIEPrefix(World->GetMapName())));
+	}
+
+	if (TrackBounds.IsValid)
+	{
+		Bake(MatchTrackGrid, TrackBounds, MatchSubsystem->GetMatchOrigin(TrackMatchId));
+		MatchTrackGrid.Save(GetGridFilename(MatchSubsystem->MatchTrackLevel.GetAssetName()));
+	}
+	else if (MatchSubsystem != nullptr && !MatchSubsystem->MatchTrackLevel.IsNull())
+	{
+		UE_LOG(LogKrazyKarts, Warning, TEXT("%s is not streamed in, its surface grid was not baked"), *MatchSubsystem->MatchTrackLevel.GetAssetName());
+	}
+}
+
+void UGoKartSurfaceSubsystem::Bake(FGrid& Grid, const FBox& Bounds, const FVector& Origin) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_SurfaceGridBake);
+
+	Grid.Unload();
+
+	float BakeCellSize = CellSize;
+	FVector2D Extent(Bounds.Max.X - Bounds.Min.X, Bounds.Max.Y - Bounds.Min.Y);
+	if ((Extent.X / BakeCellSize) * (Extent.Y / BakeCellSize) > MaxBakeCells)
+	{
+		BakeCellSize = FMath::Sqrt(Extent.X * Extent.Y / MaxBakeCells);
+	}
+
+	FGridHeader& Header = Grid.Header;
+	Header.Magic = GridMagic;
+	Header.Version = GridVersion;
+	Header.OriginX = Bounds.Min.X - Origin.X;
+	Header.OriginY = Bounds.Min.Y - Origin.Y;
+	Header.CellSize = BakeCellSize;
+	Header.Width = FMath::Max(1, FMath::CeilToInt(Extent.X / BakeCellSize));
+	Header.Height = FMath::Max(1, FMath::CeilToInt(Extent.Y / BakeCellSize));
+
+	Grid.BakedCells.SetNum(Header.Width * Header.Height);
+
+	FCollisionQueryParams QueryParams(SCENE_QUERY_STAT(BakeSurfaceGrid), true);
+	QueryParams.bReturnPhysicalMaterial = true;
+	FCollisionObjectQueryParams ObjectParams(FCollisionObjectQueryParams::AllStaticObjects);
+
+	UWorld* World = GetWorld();
+	for (int32 Y = 0; Y < Header.Height; ++Y)
+	{
+		for (int32 X = 0; X < Header.Width; ++X)
+		{
+			FVector Centre(Bounds.Min.X + (X + 0.5f) * BakeCellSize, Bounds.Min.Y + (Y + 0.5f) * BakeCellSize, 0.f);
+			FVector Start(Centre.X, Centre.Y, Bounds.Max.Z + 100.f);
+			FVector End(Centre.X, Centre.Y, Bounds.Min.Z - 100.f);
+
+			FHitResult Hit;
+			if (!World->LineTraceSingleByObjectType(Hit, Start, End, ObjectParams, QueryParams)) continue;
+
+			UPhysicalMaterial* PhysicalMaterial = Hit.PhysMaterial.Get();
+			if (PhysicalMaterial == nullptr) continue;
+
+			FGoKartSurfaceCell& Cell = Grid.BakedCells[Y * Header.Width + X];
+			Cell.SurfaceType = (uint8)UPhysicalMaterial::DetermineSurfaceType(PhysicalMaterial);
+			Cell.Friction = (uint8)FMath::Clamp(FMath::RoundToInt(PhysicalMaterial->Friction * 100.f), 0, 255);
+		}
+	}
+
+	Grid.Cells = Grid.BakedCells.GetData();
+
+	UE_LOG(LogKrazyKarts, Log, TEXT("Baked a %dx%d surface grid with %.0f cm cells"), Header.Width, Header.Height, BakeCellSize);
+}
+
+void UGoKartSurfaceSubsystem::FGrid::Save(const FString& Filename) const
+{
+	if (BakedCells.Num() == 0) return;
+
+	TArray<uint8> Bytes;
+	Bytes.SetNumUninitialized(sizeof(FGridHeader) + BakedCells.Num() * sizeof(FGoKartSurfaceCell));
+	FMemory::Memcpy(Bytes.GetData(), &Header, sizeof(FGridHeader));
+	FMemory::Memcpy(Bytes.GetData() + sizeof(FGridHeader), BakedCells.GetData(), BakedCells.Num() * sizeof(FGoKartSurfaceCell));
+
+	if (!FFileHelper::SaveArrayToFile(Bytes, *Filename))
+	{
+		UE_LOG(LogKrazyKarts, Error, TEXT("Could not save the surface grid to %s"), *Filename);
+	}
+}
@@ -0,0 +1,139 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Chaos/ChaosEngineInterface.h"
+#include "GenericPlatform/GenericPlatformFile.h"
+#include "GoKartSurfaceSubsystem.generated.h"
+
+class UKrazyKartsMatchSubsystem;
+
+/** One cell of the surface grid, exactly as it is stored in the file */
+struct FGoKartSurfaceCell
+{
+	uint8 SurfaceType = SurfaceType_Default; // EPhysicalSurface of the ground
+	uint8 Friction = 70; // Friction of the physical material in hundredths, 0.7 is the engine default
+
+	float GetFriction() const { return Friction / 100.f; }
+};
+
+static_assert(sizeof(FGoKartSurfaceCell) == 2, "FGoKartSurfaceCell is stored as is in the grid file");
+
+USTRUCT()
+struct FGoKartSurfaceRollingResistance
+{
+	GENERATED_BODY()
+
+	UPROPERTY(Config)
+	TEnumAsByte<EPhysicalSurface> Surface = SurfaceType_Default;
+
+	// Multiplies the kart's RollingResistanceCoefficient on this surface
+	UPROPERTY(Config)
+	float Scale = 1;
+};
+
+/**
+ * Surface type and friction of the ground, baked into a 2D grid per track level so a kart can look it up
+ * by its position instead of tracing down every move. The grids live in Content/SurfaceGrids/<Level>.kksurf,
+ * staged outside the pak so they can be memory mapped. The map gets one grid, and the match track one more,
+ * relative to the match origin, that every extra match looks up in. Grids are only ever written by
+ * KrazyKarts.BakeSurfaceGrid in the editor, playing only loads them.
+ */
+UCLASS(config = Game)
+class KRAZYKARTS_API UGoKartSurfaceSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+
+	// Begin USubsystem interface
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	// End USubsystem interface
+
+	/** Loads the grids once the level is fully loaded */
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+
+	/** The ground below Location. Outside of the grid, or without one, the default surface */
+	FGoKartSurfaceCell GetSurface(const FVector& Location) const;
+
+	float GetRollingResistanceScale(uint8 SurfaceType) const { return RollingResistanceScales[SurfaceType]; }
+
+	/** Traces every loaded track level into a new grid and saves it, replacing the grids in use.
+	The match track is only baked when a match has streamed it in, e.g. in PIE with a MatchCount above 1 */
+	void BakeAndSave();
+
+	/** Edge length of a grid cell (cm) */
+	UPROPERTY(Config)
+	float CellSize = 200;
+
+	/** Upper bound for the cell count of a bake, the cell size grows to stay under it on very large levels */
+	UPROPERTY(Config)
+	int32 MaxBakeCells = 1 << 20;
+
+	/** Surfaces below this friction count as low friction, e.g. ice or wet paint */
+	UPROPERTY(Config)
+	float LowFrictionThreshold = 0.3f;
+
+	/** Rolling resistance per surface type, the ones not listed use a scale of 1 */
+	UPROPERTY(Config)
+	TArray<FGoKartSurfaceRollingResistance> SurfaceRollingResistance;
+
+private:
+
+	/** Stored at the start of the file, the cells follow row by row */
+	struct FGridHeader
+	{
+		uint32 Magic = 0;
+		uint32 Version = 0;
+		float OriginX = 0;
+		float OriginY = 0;
+		float CellSize = 0;
+		int32 Width = 0;
+		int32 Height = 0;
+	};
+
+	static constexpr uint32 GridMagic = 0x4B4B5346; // 'KKSF'
+	static constexpr uint32 GridVersion = 1;
+
+	/** The grid of one track level, in the level's own space */
+	struct FGrid
+	{
+		FGridHeader Header;
+
+		/** Either points into the mapped file or into BakedCells */
+		const FGoKartSurfaceCell* Cells = nullptr;
+
+		TArray<FGoKartSurfaceCell> BakedCells;
+
+		TUniquePtr<IMappedFileHandle> MappedFile;
+
+		TUniquePtr<IMappedFileRegion> MappedRegion;
+
+		/** Maps the grid file, false if there is none or it doesn't fit this version */
+		bool Load(const FString& Filename);
+
+		void Unload();
+
+		void Save(const FString& Filename) const;
+
+		FGoKartSurfaceCell GetSurface(const FVector& Location) const;
+	};
+
+	FString GetGridFilename(const FString& LevelName) const;
+
+	/** Traces straight down through the centre of every cell of Bounds to find the physical material. The grid is stored relative to Origin */
+	void Bake(FGrid& Grid, const FBox& Bounds, const FVector& Origin) const;
+
+	/** Of the persistent level and the levels streamed into it, except the match tracks */
+	FGrid LevelGrid;
+
+	/** Of MatchTrackLevel, shared by every match that races on an instance of it */
+	FGrid MatchTrackGrid;
+
+	UKrazyKartsMatchSubsystem* MatchSubsystem = nullptr;
+
+	float RollingResistanceScales[SurfaceType_Max];
+};
@@ -8,8 +8,11 @@ public class KrazyKarts : ModuleRules
 	{
 		PCHUsage = PCHUsageMode.UseExplicitOrSharedPCHs;
 
-		PublicDependencyModuleNames.AddRange(new string[] { "Core", "CoreUObject", "Engine", "InputCore", "PhysXVehicles", "HeadMountedDisplay" });
+		PublicDependencyModuleNames.AddRange(new string[] { "Core", "CoreUObject", "Engine", "InputCore", "PhysXVehicles", "HeadMountedDisplay", "NetCore", "AnimationBudgetAllocator", "PhysicsCore" });
 
 		PublicDefinitions.Add("HMD_MODULE_INCLUDED=1");
+
+		// PhysX headers, to tune the wheel substeps of the PhysX vehicles directly
+		SetupModulePhysicsSupport(Target);
 	}
 }
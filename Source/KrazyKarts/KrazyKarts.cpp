@@ -3,5 +3,7 @@
 #include "KrazyKarts.h"
 #include "Modules/ModuleManager.h"
 
+DEFINE_LOG_CATEGORY(LogKrazyKarts);
+
 IMPLEMENT_PRIMARY_GAME_MODULE( FDefaultGameModuleImpl, KrazyKarts, "KrazyKarts" );
  
\ No newline at end of file
@@ -2,4 +2,8 @@
 
 #pragma once
 
-#include "CoreMinimal.h"
\ No newline at end of file
+#include "CoreMinimal.h"
+
+DECLARE_STATS_GROUP(TEXT("KrazyKarts"), STATGROUP_KrazyKarts, STATCAT_Advanced);
+
+DECLARE_LOG_CATEGORY_EXTERN(LogKrazyKarts, Log, All);
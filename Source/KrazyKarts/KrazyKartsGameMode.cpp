@@ -1,11 +1,278 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "KrazyKartsGameMode.h"
+#include "KrazyKarts.h"
 #include "KrazyKartsPawn.h"
+#include "KrazyKartsServerPawn.h"
 #include "KrazyKartsHud.h"
+#include "KrazyKartsPlayerController.h"
+#include "GoKartMovementComponent.h"
+#include "GoKartMovementReplicator.h"
+#include "GoKartSnapshotManager.h"
+#include "KrazyKartsSpectatorSubsystem.h"
+#include "KrazyKartsMatchSubsystem.h"
+#include "KrazyKartsPooledPawnComponent.h"
+#include "Engine/GameInstance.h"
+#include "Engine/World.h"
+
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Pawn Pool Hits"), STAT_PawnPoolHits, STATGROUP_KrazyKarts);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Pawn Pool Misses"), STAT_PawnPoolMisses, STATGROUP_KrazyKarts);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Pawn Pool Free"), STAT_PawnPoolFree, STATGROUP_KrazyKarts);
+
+// Pooled pawns wait out here, far away from the track
+static const FVector PawnPoolLocation(0.f, 0.f, -100000.f);
 
 AKrazyKartsGameMode::AKrazyKartsGameMode()
 {
 	DefaultPawnClass = AKrazyKartsPawn::StaticClass();
 	HUDClass = AKrazyKartsHud::StaticClass();
+	PlayerControllerClass = AKrazyKartsPlayerController::StaticClass();
+}
+
+void AKrazyKartsGameMode::InitGame(const FString& MapName, const FString& Options, FString& ErrorMessage)
+{
+	Super::InitGame(MapName, Options, ErrorMessage);
+
+	// Before BeginPlay, the listen server's own player logs in and gets its pawn during the map load.
+	// It has to find the matches to join and the pool to take its pawn from
+	GetWorld()->GetSubsystem<UKrazyKartsMatchSubsystem>()->CreateMatches();
+
+	UClass* PawnClass = GetDefaultPawnClassForController(nullptr);
+	for (int32 i = 0; i < PawnPoolSize; ++i)
+	{
+		APawn* Pawn = SpawnPooledPawn(PawnClass);
+		if (Pawn == nullptr) break;
+
+		DeactivatePawn(Pawn);
+		PawnPool.Add(Pawn);
+	}
+
+	SET_DWORD_STAT(STAT_PawnPoolFree, PawnPool.Num());
+}
+
+void AKrazyKartsGameMode::BeginPlay()
+{
+	Super::BeginPlay();
+
+	if (bBroadcastToSpectators)
+	{
+		GetGameInstance()->GetSubsystem<UKrazyKartsSpectatorSubsystem>()->StartBroadcast();
+	}
+}
+
+void AKrazyKartsGameMode::InitGameState()
+{
+	Super::InitGameState();
+
+	// Before any actor begins play, so every kart finds the manager when it registers.
+	// The snapshot goes to every connection, so it can't be used when the karts are split into matches
+	UKrazyKartsMatchSubsystem* MatchSubsystem = GetWorld()->GetSubsystem<UKrazyKartsMatchSubsystem>();
+	if (bUseSnapshotReplication && MatchSubsystem->MatchCount > 1)
+	{
+		UE_LOG(LogKrazyKarts, Warning, TEXT("Snapshot replication is not supported with several matches, using per kart replication"));
+	}
+	else if (bUseSnapshotReplication)
+	{
+		FActorSpawnParameters SpawnInfo;
+		SpawnInfo.ObjectFlags |= RF_Transient;
+		GetWorld()->SpawnActor<AGoKartSnapshotManager>(AGoKartSnapshotManager::StaticClass(), SpawnInfo);
+	}
+}
+
+void AKrazyKartsGameMode::PostLogin(APlayerController* NewPlayer)
+{
+	// Before Super, which spawns the pawn, so it is placed on the right track
+	UKrazyKartsMatchSubsystem* MatchSubsystem = GetWorld()->GetSubsystem<UKrazyKartsMatchSubsystem>();
+	int32 MatchId = MatchSubsystem->JoinMatch(NewPlayer);
+
+	AKrazyKartsPlayerController* PlayerController = Cast<AKrazyKartsPlayerController>(NewPlayer);
+	if (PlayerController != nullptr && !PlayerController->IsLocalController())
+	{
+		PlayerController->ClientEnterMatch(MatchId);
+	}
+
+	Super::PostLogin(NewPlayer);
+}
+
+void AKrazyKartsGameMode::Logout(AController* Exiting)
+{
+	GetWorld()->GetSubsystem<UKrazyKartsMatchSubsystem>()->LeaveMatch(Exiting);
+
+	Super::Logout(Exiting);
+}
+
+UClass* AKrazyKartsGameMode::GetDefaultPawnClassForController_Implementation(AController* InController)
+{
+	UClass* PawnClass = Super::GetDefaultPawnClassForController_Implementation(InController);
+
+	// A dedicated server has no use for the cameras and in-car text. Blueprint vehicles keep their own class
+	if (IsRunningDedicatedServer() && (PawnClass == AKrazyKartsPawn::StaticClass()))
+	{
+		return AKrazyKartsServerPawn::StaticClass();
+	}
+	return PawnClass;
+}
+
+APawn* AKrazyKartsGameMode::SpawnDefaultPawnFor_Implementation(AController* NewPlayer, AActor* StartSpot)
+{
+	UClass* PawnClass = GetDefaultPawnClassForController(NewPlayer);
+
+	// Every match races on its own copy of the track, the player starts are only placed on the first one
+	UKrazyKartsMatchSubsystem* MatchSubsystem = GetWorld()->GetSubsystem<UKrazyKartsMatchSubsystem>();
+	int32 MatchId = MatchSubsystem->GetActorMatch(NewPlayer);
+	FVector MatchOrigin = MatchSubsystem->GetMatchOrigin(MatchId);
+
+	int32 PoolIndex = PawnPool.IndexOfByPredicate([PawnClass](const APawn* Pawn) { return (Pawn != nullptr) && (Pawn->GetClass() == PawnClass); });
+	if (PoolIndex == INDEX_NONE)
+	{
+		INC_DWORD_STAT(STAT_PawnPoolMisses);
+
+		APawn* SpawnedPawn = Super::SpawnDefaultPawnFor_Implementation(NewPlayer, StartSpot);
+		if (SpawnedPawn != nullptr)
+		{
+			SpawnedPawn->OnDestroyed.AddUniqueDynamic(this, &AKrazyKartsGameMode::HandlePooledPawnDestroyed);
+		}
+		if (SpawnedPawn != nullptr && MatchId != INDEX_NONE)
+		{
+			SpawnedPawn->SetActorLocation(SpawnedPawn->GetActorLocation() + MatchOrigin, false, nullptr, ETeleportType::ResetPhysics);
+			MatchSubsystem->SetActorMatch(SpawnedPawn, MatchId);
+		}
+		return SpawnedPawn;
+	}
+
+	INC_DWORD_STAT(STAT_PawnPoolHits);
+
+	APawn* Pawn = PawnPool[PoolIndex];
+	PawnPool.RemoveAtSwap(PoolIndex);
+	SET_DWORD_STAT(STAT_PawnPoolFree, PawnPool.Num());
+
+	// Same placement as the default implementation, only the yaw of the start spot is used
+	FRotator StartRotation(ForceInit);
+	FVector StartLocation = FVector::ZeroVector;
+	if (StartSpot != nullptr)
+	{
+		StartRotation.Yaw = StartSpot->GetActorRotation().Yaw;
+		StartLocation = StartSpot->GetActorLocation();
+	}
+
+	ActivatePawn(Pawn, FTransform(StartRotation, StartLocation + MatchOrigin));
+	if (MatchId != INDEX_NONE)
+	{
+		MatchSubsystem->SetActorMatch(Pawn, MatchId);
+	}
+	return Pawn;
+}
+
+void AKrazyKartsGameMode::ReleasePawn(APawn* Pawn)
+{
+	if ((Pawn == nullptr) || PawnPool.Contains(Pawn)) return;
+
+	if (Pawn->GetController() != nullptr)
+	{
+		Pawn->GetController()->UnPossess();
+	}
+
+	// Pawns the game mode didn't spawn, placed in the level or possessed on the way, are looked after from now on
+	Pawn->OnDestroyed.AddUniqueDynamic(this, &AKrazyKartsGameMode::HandlePooledPawnDestroyed);
+
+	DeactivatePawn(Pawn);
+	PawnPool.Add(Pawn);
+	SET_DWORD_STAT(STAT_PawnPoolFree, PawnPool.Num());
+
+	GetWorld()->GetSubsystem<UKrazyKartsMatchSubsystem>()->ClearActorMatch(Pawn);
+}
+
+void AKrazyKartsGameMode::RespawnPlayer(AController* Player)
+{
+	if (Player == nullptr) return;
+
+	ReleasePawn(Player->GetPawn());
+	RestartPlayer(Player);
+}
+
+void AKrazyKartsGameMode::HandlePooledPawnDestroyed(AActor* DestroyedActor)
+{
+	APawn* Pawn = Cast<APawn>(DestroyedActor);
+	PawnPool.Remove(Pawn);
+
+	UWorld* World = GetWorld();
+	if ((Pawn == nullptr) || (World == nullptr) || World->bIsTearingDown || (PawnPool.Num() >= PawnPoolSize)) return;
+
+	APawn* Replacement = SpawnPooledPawn(Pawn->GetClass());
+	if (Replacement != nullptr)
+	{
+		DeactivatePawn(Replacement);
+		PawnPool.Add(Replacement);
+	}
+
+	SET_DWORD_STAT(STAT_PawnPoolFree, PawnPool.Num());
+}
+
+APawn* AKrazyKartsGameMode::SpawnPooledPawn(UClass* PawnClass)
+{
+	FActorSpawnParameters SpawnInfo;
+	SpawnInfo.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	SpawnInfo.ObjectFlags |= RF_Transient; // We never want to save default player pawns into a map
+
+	APawn* Pawn = GetWorld()->SpawnActor<APawn>(PawnClass, FTransform(PawnPoolLocation), SpawnInfo);
+	if (Pawn != nullptr)
+	{
+		Pawn->OnDestroyed.AddUniqueDynamic(this, &AKrazyKartsGameMode::HandlePooledPawnDestroyed);
+	}
+	return Pawn;
+}
+
+void AKrazyKartsGameMode::DeactivatePawn(APawn* Pawn)
+{
+	// Park it with the PhysX vehicle back in place, so activating only has to restore the class defaults
+	AKrazyKartsPawn* Vehicle = Cast<AKrazyKartsPawn>(Pawn);
+	if (Vehicle != nullptr)
+	{
+		Vehicle->SetSimulationLOD(EKrazyKartsSimulationLOD::Full);
+	}
+
+	// Pawns that joined the pool after a miss get their component here
+	UKrazyKartsPooledPawnComponent* PooledPawn = Pawn->FindComponentByClass<UKrazyKartsPooledPawnComponent>();
+	if (PooledPawn == nullptr)
+	{
+		PooledPawn = NewObject<UKrazyKartsPooledPawnComponent>(Pawn, TEXT("PooledPawn"));
+		PooledPawn->RegisterComponent();
+	}
+
+	PooledPawn->SetInPool(true);
+
+	Pawn->TeleportTo(PawnPoolLocation, FRotator::ZeroRotator, false, true);
+
+	// A hidden actor without collision is never relevant on its own, so clients would destroy it and create it again on the next join.
+	// Always relevant keeps it on every client, and dormant it costs no replication while it sits in the pool
+	Pawn->bAlwaysRelevant = true;
+	Pawn->ForceNetUpdate();
+	Pawn->SetNetDormancy(DORM_DormantAll);
+}
+
+void AKrazyKartsGameMode::ActivatePawn(APawn* Pawn, const FTransform& Transform)
+{
+	Pawn->SetNetDormancy(DORM_Awake);
+	Pawn->bAlwaysRelevant = Pawn->GetClass()->GetDefaultObject<AActor>()->bAlwaysRelevant;
+
+	Pawn->SetActorTransform(Transform, false, nullptr, ETeleportType::ResetPhysics);
+
+	// Restores whatever the class defaults say, on the clients too once the flag arrives
+	UKrazyKartsPooledPawnComponent* PooledPawn = Pawn->FindComponentByClass<UKrazyKartsPooledPawnComponent>();
+	if (PooledPawn != nullptr)
+	{
+		PooledPawn->SetInPool(false);
+	}
+
+	UGoKartMovementReplicator* MovementReplicator = Pawn->FindComponentByClass<UGoKartMovementReplicator>();
+	if (MovementReplicator != nullptr)
+	{
+		MovementReplicator->ResetMovementState();
+	}
+
+	UGoKartMovementComponent* MovementComponent = Pawn->FindComponentByClass<UGoKartMovementComponent>();
+	if (MovementComponent != nullptr)
+	{
+		MovementComponent->SetVelocity(FVector::ZeroVector);
+	}
 }
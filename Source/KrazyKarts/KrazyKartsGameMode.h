@@ -3,14 +3,58 @@
 #include "GameFramework/GameModeBase.h"
 #include "KrazyKartsGameMode.generated.h"
 
-UCLASS(minimalapi)
+UCLASS(minimalapi, config=Game)
 class AKrazyKartsGameMode : public AGameModeBase
 {
 	GENERATED_BODY()
 
 public:
 	AKrazyKartsGameMode();
-};
 
+	// Begin AGameModeBase interface
+	virtual void InitGame(const FString& MapName, const FString& Options, FString& ErrorMessage) override;
+	virtual UClass* GetDefaultPawnClassForController_Implementation(AController* InController) override;
+	virtual APawn* SpawnDefaultPawnFor_Implementation(AController* NewPlayer, AActor* StartSpot) override;
+	virtual void InitGameState() override;
+	virtual void PostLogin(APlayerController* NewPlayer) override;
+	virtual void Logout(AController* Exiting) override;
+	// End AGameModeBase interface
+
+	/** Takes the pawn away from its controller and parks it in the pool instead of destroying it */
+	void ReleasePawn(APawn* Pawn);
+
+	/** Releases the player's current pawn and restarts them with one from the pool */
+	void RespawnPlayer(AController* Player);
+
+protected:
+	virtual void BeginPlay() override;
+
+	/** How many pawns are created up front at map load, so joining (the listen server's own player included) doesn't construct a kart */
+	UPROPERTY(Config)
+	int32 PawnPoolSize = 8;
+
+	/** Replicate all karts through one AGoKartSnapshotManager instead of a ServerState property per kart. Pays off with many karts per connection */
+	UPROPERTY(Config)
+	bool bUseSnapshotReplication = false;
+
+	/** Record the race as a live stream spectators can watch through UKrazyKartsSpectatorSubsystem */
+	UPROPERTY(Config)
+	bool bBroadcastToSpectators = false;
+
+private:
+	APawn* SpawnPooledPawn(UClass* PawnClass);
+
+	void DeactivatePawn(APawn* Pawn);
+
+	void ActivatePawn(APawn* Pawn, const FTransform& Transform);
+
+	/** Keeps the pool at its size when a pawn is destroyed instead of released, so later joins still find one */
+	UFUNCTION()
+	void HandlePooledPawnDestroyed(AActor* DestroyedActor);
+
+	/** Pawns that are ready to be handed out, hidden, dormant and without collision */
+	UPROPERTY()
+	TArray<APawn*> PawnPool;
+};
 
 
@@ -11,6 +11,7 @@
 #include "CanvasItem.h"
 #include "UObject/ConstructorHelpers.h"
 #include "Engine/Engine.h"
+#include "KrazyKartsTrackProgressSubsystem.h"
 
 #define LOCTEXT_NAMESPACE "VehicleHUD"
 
@@ -39,6 +40,8 @@ void AKrazyKartsHud::DrawHUD()
 	// We dont want the onscreen hud when using a HMD device	
 	if (bWantHUD == true)
 	{
+		DrawRaceProgress(HUDXRatio, HUDYRatio);
+
 		// Get our vehicle so we can check if we are in car. If we are we don't want onscreen HUD
 		AKrazyKartsPawn* Vehicle = Cast<AKrazyKartsPawn>(GetOwningPawn());
 		if ((Vehicle != nullptr) && (Vehicle->bInCarCameraActive == false))
@@ -58,5 +61,27 @@ void AKrazyKartsHud::DrawHUD()
 	}
 }
 
+void AKrazyKartsHud::DrawRaceProgress(float HUDXRatio, float HUDYRatio)
+{
+	const UKrazyKartsTrackProgressSubsystem* TrackProgress = GetWorld()->GetSubsystem<UKrazyKartsTrackProgressSubsystem>();
+	const FKrazyKartsKartProgress* Progress = TrackProgress != nullptr ? TrackProgress->GetProgress(GetOwningPawn()) : nullptr;
+	if (Progress == nullptr) return;
+
+	UpdateRaceText(Progress->Position, TrackProgress->GetNumRacers(*Progress), FMath::Max(Progress->Lap + 1, 1));
+
+	FCanvasTextItem RaceTextItem(FVector2D(HUDXRatio * 805.f, HUDYRatio * 410.f), RaceText, HUDFont, FLinearColor::White);
+	RaceTextItem.Scale = FVector2D(HUDYRatio * 1.4f, HUDYRatio * 1.4f);
+	Canvas->DrawItem(RaceTextItem);
+}
+
+void AKrazyKartsHud::UpdateRaceText(int32 Position, int32 Racers, int32 Lap)
+{
+	if (Position == DisplayedPosition && Racers == DisplayedRacers && Lap == DisplayedLap) return;
+
+	RaceText = FText::Format(LOCTEXT("RaceProgressFormat", "Pos {0}/{1}  Lap {2}"), FText::AsNumber(Position), FText::AsNumber(Racers), FText::AsNumber(Lap));
+	DisplayedPosition = Position;
+	DisplayedRacers = Racers;
+	DisplayedLap = Lap;
+}
 
 #undef LOCTEXT_NAMESPACE
@@ -19,4 +19,20 @@ public:
 	// Begin AHUD interface
 	virtual void DrawHUD() override;
 	// End AHUD interface
+
+private:
+	/** Race position and lap of the owning pawn, if it is on a track */
+	void DrawRaceProgress(float HUDXRatio, float HUDYRatio);
+
+	/** Formats RaceText, only when one of the numbers changed since the last call */
+	void UpdateRaceText(int32 Position, int32 Racers, int32 Lap);
+
+	/** Formatted race progress, only rebuilt when one of the numbers below changes */
+	FText RaceText;
+	int32 DisplayedPosition = INDEX_NONE;
+	int32 DisplayedRacers = INDEX_NONE;
+	int32 DisplayedLap = INDEX_NONE;
+
+	// Ticks the HUD strings without a canvas, see Tests/GoKartTickAllocationTest.cpp
+	friend class FGoKartTickAllocationTest;
 };
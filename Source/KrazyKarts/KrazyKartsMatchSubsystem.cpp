@@ -0,0 +1,212 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "KrazyKartsMatchSubsystem.h"
+#include "KrazyKarts.h"
+#include "Engine/World.h"
+#include "Engine/LevelStreamingDynamic.h"
+#include "GameFramework/Controller.h"
+#include "HAL/IConsoleManager.h"
+
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Matches"), STAT_Matches, STATGROUP_KrazyKarts);
+
+static FAutoConsoleCommandWithWorld DumpMatchesCommand(
+	TEXT("KrazyKarts.DumpMatches"),
+	TEXT("Logs players and kart tick cost of every match hosted by this server"),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		UKrazyKartsMatchSubsystem* MatchSubsystem = World != nullptr ? World->GetSubsystem<UKrazyKartsMatchSubsystem>() : nullptr;
+		if (MatchSubsystem != nullptr)
+		{
+			MatchSubsystem->DumpMatches();
+		}
+	}));
+
+void UKrazyKartsMatchSubsystem::CreateMatches()
+{
+	int32 Count = FMath::Max(1, MatchCount);
+	if (Count > 1 && MatchTrackLevel.IsNull())
+	{
+		UE_LOG(LogKrazyKarts, Warning, TEXT("MatchCount is %d but there is no MatchTrackLevel to give each match its own track, hosting a single match"), Count);
+		Count = 1;
+	}
+
+	Matches.SetNum(Count);
+	for (int32 MatchId = 0; MatchId < Count; ++MatchId)
+	{
+		Matches[MatchId].Origin = FVector(0.f, MatchId * MatchSpacing, 0.f);
+		LoadMatchTrack(MatchId);
+	}
+
+	LastDumpTime = FPlatformTime::Seconds();
+	SET_DWORD_STAT(STAT_Matches, Count);
+}
+
+void UKrazyKartsMatchSubsystem::LoadMatchTrack(int32 MatchId)
+{
+	if (MatchId <= 0 || MatchTrackLevel.IsNull()) return; // The first match races on the persistent level's track
+
+	if (Matches.Num() <= MatchId)
+	{
+		Matches.SetNum(MatchId + 1); // On a client this is the only match we know about
+	}
+
+	FKrazyKartsMatch& Match = Matches[MatchId];
+	if (Match.TrackInstance != nullptr) return;
+
+	Match.Origin = FVector(0.f, MatchId * MatchSpacing, 0.f);
+
+	bool bSuccess = false;
+	FString LevelName = FString::Printf(TEXT("%s_Match%d"), *MatchTrackLevel.GetAssetName(), MatchId);
+	Match.TrackInstance = ULevelStreamingDynamic::LoadLevelInstanceBySoftObjectPtr(GetWorld(), MatchTrackLevel, Match.Origin, FRotator::ZeroRotator, bSuccess, LevelName);
+	if (!bSuccess)
+	{
+		UE_LOG(LogKrazyKarts, Error, TEXT("Could not stream in %s for match %d"), *MatchTrackLevel.ToString(), MatchId);
+	}
+}
+
+int32 UKrazyKartsMatchSubsystem::JoinMatch(AController* Player)
+{
+	int32 Current = GetActorMatch(Player);
+	if (Current != INDEX_NONE) return Current;
+
+	int32 MatchId = 0;
+	for (int32 i = 1; i < Matches.Num(); ++i)
+	{
+		if (Matches[i].NumPlayers < Matches[MatchId].NumPlayers)
+		{
+			MatchId = i;
+		}
+	}
+
+	if (Matches.IsValidIndex(MatchId))
+	{
+		++Matches[MatchId].NumPlayers;
+	}
+
+	SetActorMatch(Player, MatchId);
+	return MatchId;
+}
+
+void UKrazyKartsMatchSubsystem::LeaveMatch(AController* Player)
+{
+	int32 MatchId = GetActorMatch(Player);
+	if (Matches.IsValidIndex(MatchId))
+	{
+		--Matches[MatchId].NumPlayers;
+	}
+
+	ClearActorMatch(Player);
+}
+
+void UKrazyKartsMatchSubsystem::SetActorMatch(AActor* Actor, int32 MatchId)
+{
+	if (Actor == nullptr) return;
+
+	ActorMatches.Add(Actor, MatchId);
+	Actor->OnDestroyed.AddUniqueDynamic(this, &UKrazyKartsMatchSubsystem::HandleActorDestroyed);
+}
+
+void UKrazyKartsMatchSubsystem::ClearActorMatch(AActor* Actor)
+{
+	if (Actor == nullptr) return;
+
+	ActorMatches.Remove(Actor);
+	Actor->OnDestroyed.RemoveDynamic(this, &UKrazyKartsMatchSubsystem::HandleActorDestroyed);
+}
+
+void UKrazyKartsMatchSubsystem::HandleActorDestroyed(AActor* DestroyedActor)
+{
+	// Logout already took a player out of its match, this is for controllers that never got that far
+	AController* Player = Cast<AController>(DestroyedActor);
+	if (Player != nullptr)
+	{
+		LeaveMatch(Player);
+	}
+	else
+	{
+		ClearActorMatch(DestroyedActor);
+	}
+}
+
+int32 UKrazyKartsMatchSubsystem::GetActorMatch(const AActor* Actor) const
+{
+	const int32* MatchId = ActorMatches.Find(Actor);
+	return MatchId != nullptr ? *MatchId : INDEX_NONE;
+}
+
+bool UKrazyKartsMatchSubsystem::AreInSameMatch(const AActor* A, const AActor* B) const
+{
+	if (!IsPartitioned()) return true;
+
+	int32 MatchA = GetActorMatch(A);
+	int32 MatchB = GetActorMatch(B);
+	return MatchA == INDEX_NONE || MatchB == INDEX_NONE || MatchA == MatchB;
+}
+
+FVector UKrazyKartsMatchSubsystem::GetMatchOrigin(int32 MatchId) const
+{
+	return Matches.IsValidIndex(MatchId) ? Matches[MatchId].Origin : FVector::ZeroVector;
+}
+
+int32 UKrazyKartsMatchSubsystem::GetMatchAtLocation(const FVector& Location) const
+{
+	if (!IsPartitioned() || MatchSpacing <= 0) return 0;
+
+	return FMath::Clamp(FMath::RoundToInt(Location.Y / MatchSpacing), 0, Matches.Num() - 1);
+}
+
+int32 UKrazyKartsMatchSubsystem::GetLevelMatch(const ULevel* Level) const
+{
+	if (Level == nullptr) return INDEX_NONE;
+
+	for (int32 MatchId = 0; MatchId < Matches.Num(); ++MatchId)
+	{
+		const ULevelStreamingDynamic* TrackInstance = Matches[MatchId].TrackInstance;
+		if (TrackInstance != nullptr && TrackInstance->GetLoadedLevel() == Level) return MatchId;
+	}
+	return INDEX_NONE;
+}
+
+void UKrazyKartsMatchSubsystem::AddMatchTickTime(int32 MatchId, double Seconds)
+{
+	if (Matches.IsValidIndex(MatchId))
+	{
+		Matches[MatchId].TickSeconds += Seconds;
+	}
+}
+
+void UKrazyKartsMatchSubsystem::DumpMatches()
+{
+	double Now = FPlatformTime::Seconds();
+	double Elapsed = FMath::Max(Now - LastDumpTime, SMALL_NUMBER);
+	LastDumpTime = Now;
+
+	for (int32 MatchId = 0; MatchId < Matches.Num(); ++MatchId)
+	{
+		FKrazyKartsMatch& Match = Matches[MatchId];
+		double TickMilliseconds = Match.TickSeconds * 1000.0 / Elapsed;
+		UE_LOG(LogKrazyKarts, Log, TEXT("Match %d: %d players, kart tick %.2f ms per second"), MatchId, Match.NumPlayers, TickMilliseconds);
+		if (TickMilliseconds > MatchTickBudget)
+		{
+			UE_LOG(LogKrazyKarts, Warning, TEXT("Match %d is over its kart tick budget of %.2f ms per second"), MatchId, MatchTickBudget);
+		}
+		Match.TickSeconds = 0;
+	}
+}
+
+FKrazyKartsMatchTickScope::FKrazyKartsMatchTickScope(const AActor* InActor)
+{
+	UWorld* World = InActor->GetWorld();
+	MatchSubsystem = World != nullptr ? World->GetSubsystem<UKrazyKartsMatchSubsystem>() : nullptr;
+	if (MatchSubsystem == nullptr || !MatchSubsystem->IsPartitioned()) return;
+
+	MatchId = MatchSubsystem->GetActorMatch(InActor);
+	StartCycles = FPlatformTime::Cycles64();
+}
+
+FKrazyKartsMatchTickScope::~FKrazyKartsMatchTickScope()
+{
+	if (MatchId == INDEX_NONE) return;
+
+	MatchSubsystem->AddMatchTickTime(MatchId, FPlatformTime::ToSeconds64(FPlatformTime::Cycles64() - StartCycles));
+}
@@ -0,0 +1,121 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "KrazyKartsMatchSubsystem.generated.h"
+
+class AController;
+class ULevel;
+class ULevelStreamingDynamic;
+
+USTRUCT()
+struct FKrazyKartsMatch
+{
+	GENERATED_BODY()
+
+	/** Where this match's copy of the track sits in the world */
+	FVector Origin = FVector::ZeroVector;
+
+	int32 NumPlayers = 0;
+
+	/** Game thread time spent ticking this match's karts since the last DumpMatches (s) */
+	double TickSeconds = 0;
+
+	UPROPERTY()
+	ULevelStreamingDynamic* TrackInstance = nullptr;
+};
+
+/**
+ * Hosts several isolated races in one server world. Every match after the first gets its own instance of
+ * MatchTrackLevel, MatchSpacing apart, and karts only replicate to players of their own match.
+ * The world, its assets and the PhysX scene are shared, which is what makes a match cheap.
+ */
+UCLASS(config = Game)
+class KRAZYKARTS_API UKrazyKartsMatchSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+
+	/** Server side. Sets up the matches and streams in their track instances, before anyone logs in */
+	void CreateMatches();
+
+	/** Streams in the track of a match, on the server for every match and on a client for the one it plays in */
+	void LoadMatchTrack(int32 MatchId);
+
+	/** Puts the player in the emptiest match */
+	int32 JoinMatch(AController* Player);
+
+	void LeaveMatch(AController* Player);
+
+	/** The actor leaves the map by itself when it is destroyed */
+	void SetActorMatch(AActor* Actor, int32 MatchId);
+
+	void ClearActorMatch(AActor* Actor);
+
+	/** INDEX_NONE for actors that belong to no match in particular */
+	int32 GetActorMatch(const AActor* Actor) const;
+
+	/** True unless both actors belong to different matches */
+	bool AreInSameMatch(const AActor* A, const AActor* B) const;
+
+	FVector GetMatchOrigin(int32 MatchId) const;
+
+	/** The match whose track is closest to Location, 0 on a server with a single match */
+	int32 GetMatchAtLocation(const FVector& Location) const;
+
+	/** The match whose streamed in track instance Level is, INDEX_NONE for every other level */
+	int32 GetLevelMatch(const ULevel* Level) const;
+
+	int32 GetNumMatches() const { return FMath::Max(1, Matches.Num()); }
+
+	bool IsPartitioned() const { return Matches.Num() > 1; }
+
+	void AddMatchTickTime(int32 MatchId, double Seconds);
+
+	/** Logs players and tick cost per match, with a warning for every match over MatchTickBudget */
+	void DumpMatches();
+
+	/** How many races this server hosts at once */
+	UPROPERTY(Config)
+	int32 MatchCount = 1;
+
+	/** Track streamed in once per extra match. Without it every match would share the same road, so there is only one */
+	UPROPERTY(Config)
+	TSoftObjectPtr<UWorld> MatchTrackLevel;
+
+	/** Distance (cm) between the tracks of two matches, far enough that they never see or touch each other */
+	UPROPERTY(Config)
+	float MatchSpacing = 200000;
+
+	/** Kart tick time one match may use per second of real time (ms). Only reported by DumpMatches, nothing is throttled */
+	UPROPERTY(Config)
+	float MatchTickBudget = 50;
+
+private:
+
+	/** Drops actors that are destroyed without going through LeaveMatch or ClearActorMatch */
+	UFUNCTION()
+	void HandleActorDestroyed(AActor* DestroyedActor);
+
+	UPROPERTY()
+	TArray<FKrazyKartsMatch> Matches;
+
+	TMap<TWeakObjectPtr<const AActor>, int32> ActorMatches;
+
+	double LastDumpTime = 0;
+};
+
+/** Adds the game thread time of its scope to the match of the actor, on a partitioned server */
+struct KRAZYKARTS_API FKrazyKartsMatchTickScope
+{
+	explicit FKrazyKartsMatchTickScope(const AActor* InActor);
+	~FKrazyKartsMatchTickScope();
+
+private:
+	UKrazyKartsMatchSubsystem* MatchSubsystem = nullptr;
+	int32 MatchId = INDEX_NONE;
+	uint64 StartCycles = 0;
+};
@@ -0,0 +1,179 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "KrazyKartsOverloadSubsystem.h"
+#include "KrazyKarts.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "GameFramework/Pawn.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/App.h"
+
+DECLARE_CYCLE_STAT(TEXT("Overload Controller"), STAT_OverloadController, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Overload Level"), STAT_OverloadLevel, STATGROUP_KrazyKarts);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Overload Frame Time (ms)"), STAT_OverloadFrameTime, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Overload Throttled Karts"), STAT_OverloadThrottledKarts, STATGROUP_KrazyKarts);
+
+static TAutoConsoleVariable<int32> CVarForceOverloadLevel(
+	TEXT("KrazyKarts.ForceOverloadLevel"),
+	-1,
+	TEXT("Holds the server at this overload level (0 none .. 4 coarse LOD) instead of following the frame time. -1 to disable"));
+
+int32 UKrazyKartsOverloadSubsystem::GetMaxStepsPerServerTick(int32 MaxSteps) const
+{
+	return Level >= EKrazyKartsOverloadLevel::CappedReplay ? FMath::Min(MaxSteps, FMath::Max(1, OverloadMaxStepsPerServerTick)) : MaxSteps;
+}
+
+int32 UKrazyKartsOverloadSubsystem::GetMaxWheelSubstepsPerFrame(int32 MaxSubsteps) const
+{
+	return Level >= EKrazyKartsOverloadLevel::ReducedSubsteps ? FMath::RoundToInt(MaxSubsteps * OverloadWheelSubstepScale) : MaxSubsteps;
+}
+
+int32 UKrazyKartsOverloadSubsystem::GetMaxFullSimulationVehicles(int32 MaxVehicles) const
+{
+	return Level >= EKrazyKartsOverloadLevel::CoarseLOD ? FMath::RoundToInt(MaxVehicles * OverloadFullSimulationScale) : MaxVehicles;
+}
+
+void UKrazyKartsOverloadSubsystem::Deinitialize()
+{
+	BaseNetUpdateFrequencies.Reset();
+
+	Super::Deinitialize();
+}
+
+ETickableTickType UKrazyKartsOverloadSubsystem::GetTickableTickType() const
+{
+	// The CDO is constructed like any other object, it must never end up ticking
+	return HasAnyFlags(RF_ClassDefaultObject) ? ETickableTickType::Never : ETickableTickType::Always;
+}
+
+TStatId UKrazyKartsOverloadSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UKrazyKartsOverloadSubsystem, STATGROUP_Tickables);
+}
+
+void UKrazyKartsOverloadSubsystem::Tick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_OverloadController);
+
+	UWorld* World = GetWorld();
+	if (World == nullptr || World->GetNetMode() == NM_Client) return; // Clients have nothing to give up for the server
+
+	// Real time, and without the idling for the tick rate cap, else a server that keeps up would look busy
+	float RealDeltaTime = FApp::GetDeltaTime();
+	float FrameTime = FMath::Max(RealDeltaTime - (float)FApp::GetIdleTime(), 0.f);
+
+	float Alpha = 1 - FMath::Exp(-RealDeltaTime / FMath::Max(FrameTimeSmoothingTime, KINDA_SMALL_NUMBER));
+	SmoothedFrameTime = FMath::Lerp(SmoothedFrameTime, FrameTime, Alpha);
+
+	int32 ForcedLevel = CVarForceOverloadLevel.GetValueOnGameThread();
+	if (ForcedLevel >= 0)
+	{
+		SetLevel((EKrazyKartsOverloadLevel)FMath::Min(ForcedLevel, (int32)EKrazyKartsOverloadLevel::Max - 1));
+	}
+	else
+	{
+		// Between the two thresholds both timers reset, the level holds
+		bool bOverBudget = SmoothedFrameTime > FrameTimeBudget;
+		bool bUnderBudget = SmoothedFrameTime < FrameTimeBudget * RecoveryRatio;
+		TimeOverBudget = bOverBudget ? TimeOverBudget + RealDeltaTime : 0;
+		TimeUnderBudget = bUnderBudget ? TimeUnderBudget + RealDeltaTime : 0;
+
+		if (TimeOverBudget >= StepUpTime && Level < (EKrazyKartsOverloadLevel)((int32)EKrazyKartsOverloadLevel::Max - 1))
+		{
+			SetLevel((EKrazyKartsOverloadLevel)((int32)Level + 1));
+		}
+		else if (TimeUnderBudget >= StepDownTime && Level > EKrazyKartsOverloadLevel::None)
+		{
+			SetLevel((EKrazyKartsOverloadLevel)((int32)Level - 1));
+		}
+	}
+
+	UpdateDistantKarts(RealDeltaTime);
+
+	SET_DWORD_STAT(STAT_OverloadLevel, (uint32)Level);
+	SET_FLOAT_STAT(STAT_OverloadFrameTime, SmoothedFrameTime * 1000.f);
+	SET_DWORD_STAT(STAT_OverloadThrottledKarts, BaseNetUpdateFrequencies.Num());
+}
+
+void UKrazyKartsOverloadSubsystem::SetLevel(EKrazyKartsOverloadLevel NewLevel)
+{
+	if (NewLevel == Level) return;
+
+	UE_LOG(LogKrazyKarts, Log, TEXT("Server overload level %s -> %s, smoothed frame time %.1f ms of %.1f ms"),
+		*UEnum::GetValueAsString(Level), *UEnum::GetValueAsString(NewLevel), SmoothedFrameTime * 1000.f, FrameTimeBudget * 1000.f);
+
+	Level = NewLevel;
+
+	// Each level gets the full time to prove itself before the next decision
+	TimeOverBudget = 0;
+	TimeUnderBudget = 0;
+	DistantKartTimer = 0;
+}
+
+void UKrazyKartsOverloadSubsystem::UpdateDistantKarts(float DeltaTime)
+{
+	DistantKartTimer -= DeltaTime;
+	if (DistantKartTimer > 0) return;
+	DistantKartTimer = DistantKartUpdateInterval;
+
+	bool bThrottle = Level >= EKrazyKartsOverloadLevel::ReducedReplication;
+	if (!bThrottle && BaseNetUpdateFrequencies.Num() == 0) return;
+
+	UWorld* World = GetWorld();
+
+	// A kart driven by a player is at its own view point, so it is never distant
+	TArray<FVector, TInlineAllocator<8>> ViewLocations;
+	if (bThrottle)
+	{
+		for (FConstPlayerControllerIterator Iterator = World->GetPlayerControllerIterator(); Iterator; ++Iterator)
+		{
+			APlayerController* PlayerController = Iterator->Get();
+			if (PlayerController == nullptr) continue;
+
+			FVector Location;
+			FRotator Rotation;
+			PlayerController->GetPlayerViewPoint(Location, Rotation);
+			ViewLocations.Add(Location);
+		}
+	}
+
+	for (TActorIterator<APawn> It(World); It; ++It)
+	{
+		APawn* Kart = *It;
+		if (!Kart->HasAuthority()) continue;
+
+		bool bDistant = false;
+		if (bThrottle && ViewLocations.Num() > 0 && !Kart->IsHidden())
+		{
+			float DistanceSquared = MAX_flt;
+			for (const FVector& ViewLocation : ViewLocations)
+			{
+				DistanceSquared = FMath::Min(DistanceSquared, FVector::DistSquared(ViewLocation, Kart->GetActorLocation()));
+			}
+			bDistant = DistanceSquared > FMath::Square(DistantKartDistance);
+		}
+
+		const float* BaseFrequency = BaseNetUpdateFrequencies.Find(Kart);
+		if (bDistant && BaseFrequency == nullptr)
+		{
+			BaseNetUpdateFrequencies.Add(Kart, Kart->NetUpdateFrequency);
+
+			// Karts that already replicate rarely (AGoKart runs at 1 Hz) are left alone rather than raised to the minimum
+			Kart->NetUpdateFrequency = FMath::Min(Kart->NetUpdateFrequency, FMath::Max(Kart->NetUpdateFrequency * DistantNetUpdateFrequencyScale, MinNetUpdateFrequency));
+		}
+		else if (!bDistant && BaseFrequency != nullptr)
+		{
+			Kart->NetUpdateFrequency = *BaseFrequency;
+			BaseNetUpdateFrequencies.Remove(Kart);
+		}
+	}
+
+	for (auto It = BaseNetUpdateFrequencies.CreateIterator(); It; ++It)
+	{
+		if (!It.Key().IsValid())
+		{
+			It.RemoveCurrent();
+		}
+	}
+}
@@ -0,0 +1,126 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "KrazyKartsOverloadSubsystem.generated.h"
+
+/** How far the server has stepped down to keep up. Every level keeps the cuts of the ones below it */
+UENUM()
+enum class EKrazyKartsOverloadLevel : uint8
+{
+	None,
+	ReducedReplication,	// Karts far from every player replicate less often
+	CappedReplay,		// Less simulated time of buffered client moves per kart and frame
+	ReducedSubsteps,	// Smaller wheel substep budget
+	CoarseLOD,			// Fewer vehicles get the full PhysX simulation
+
+	Max UMETA(Hidden)
+};
+
+/**
+ * Watches the server's frame time and trades quality for time when it runs over budget, one level at a time.
+ * It steps up after being over budget for a while and back down only after being well under it for longer,
+ * so a single hitch doesn't flip the whole server back and forth. The systems it throttles ask it for their limits.
+ */
+UCLASS(config = Game)
+class KRAZYKARTS_API UKrazyKartsOverloadSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+
+	EKrazyKartsOverloadLevel GetLevel() const { return Level; }
+
+	/** UGoKartMovementReplicator's limit in simulation steps, capped from CappedReplay on */
+	int32 GetMaxStepsPerServerTick(int32 MaxSteps) const;
+
+	/** UKrazyKartsVehicleSubsystem's wheel substep budget, scaled from ReducedSubsteps on */
+	int32 GetMaxWheelSubstepsPerFrame(int32 MaxSubsteps) const;
+
+	/** UKrazyKartsVehicleSubsystem's full simulation budget, scaled at CoarseLOD */
+	int32 GetMaxFullSimulationVehicles(int32 MaxVehicles) const;
+
+	// Begin UWorldSubsystem interface
+	virtual void Deinitialize() override;
+	// End UWorldSubsystem interface
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual ETickableTickType GetTickableTickType() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	virtual TStatId GetStatId() const override;
+	// End FTickableGameObject interface
+
+	/** Time the server may spend on a frame (s), without the time it idles to hold its tick rate */
+	UPROPERTY(Config)
+	float FrameTimeBudget = 1.f / 30.f;
+
+	/** Time constant of the frame time smoothing (s) */
+	UPROPERTY(Config)
+	float FrameTimeSmoothingTime = 0.25f;
+
+	/** The smoothed frame time must stay above FrameTimeBudget this long (s) before the next level is entered */
+	UPROPERTY(Config)
+	float StepUpTime = 0.5f;
+
+	/** Fraction of FrameTimeBudget the smoothed frame time must stay under before a level is left. The gap to 1 is the hysteresis */
+	UPROPERTY(Config)
+	float RecoveryRatio = 0.75f;
+
+	/** ...and for how long (s). Longer than StepUpTime, so we don't recover straight into the next overload */
+	UPROPERTY(Config)
+	float StepDownTime = 3;
+
+	/** Karts further than this from every player (cm) count as distant */
+	UPROPERTY(Config)
+	float DistantKartDistance = 10000;
+
+	/** NetUpdateFrequency multiplier of distant karts */
+	UPROPERTY(Config)
+	float DistantNetUpdateFrequencyScale = 0.25f;
+
+	/** Distant karts are never throttled below this NetUpdateFrequency */
+	UPROPERTY(Config)
+	float MinNetUpdateFrequency = 2;
+
+	/** How often (s) karts are re-sorted into distant and close ones */
+	UPROPERTY(Config)
+	float DistantKartUpdateInterval = 0.5f;
+
+	/** Simulation steps of client moves a kart may replay per frame from CappedReplay on. A step is the kart's MaxSimulationStep,
+	so this bounds simulated time, however the client cut it into runs. Moves that don't fit wait in the buffer. Once the buffer is full,
+	UGoKartMovementReplicator drops the oldest and corrects the client, so a server that can't keep up loses client time instead of falling behind */
+	UPROPERTY(Config)
+	int32 OverloadMaxStepsPerServerTick = 4;
+
+	/** Wheel substep budget multiplier from ReducedSubsteps on */
+	UPROPERTY(Config)
+	float OverloadWheelSubstepScale = 0.5f;
+
+	/** Full simulation budget multiplier at CoarseLOD */
+	UPROPERTY(Config)
+	float OverloadFullSimulationScale = 0.5f;
+
+private:
+
+	void SetLevel(EKrazyKartsOverloadLevel NewLevel);
+
+	/** Lowers the NetUpdateFrequency of distant karts while at ReducedReplication or above, and gives it back otherwise */
+	void UpdateDistantKarts(float DeltaTime);
+
+	EKrazyKartsOverloadLevel Level = EKrazyKartsOverloadLevel::None;
+
+	float SmoothedFrameTime = 0;
+
+	float TimeOverBudget = 0;
+
+	float TimeUnderBudget = 0;
+
+	float DistantKartTimer = 0;
+
+	// NetUpdateFrequency the throttled karts had before, to restore it
+	TMap<TWeakObjectPtr<APawn>, float> BaseNetUpdateFrequencies;
+};
@@ -4,17 +4,30 @@
 #include "KrazyKartsWheelFront.h"
 #include "KrazyKartsWheelRear.h"
 #include "KrazyKartsHud.h"
+#include "KrazyKartsGameMode.h"
 #include "Components/SkeletalMeshComponent.h"
 #include "GameFramework/SpringArmComponent.h"
 #include "Camera/CameraComponent.h"
 #include "Components/InputComponent.h"
 #include "WheeledVehicleMovementComponent4W.h"
+#include "KrazyKartsVehicleMovementComponent.h"
 #include "Engine/SkeletalMesh.h"
 #include "Engine/Engine.h"
-#include "UObject/ConstructorHelpers.h"
+#include "Engine/AssetManager.h"
+#include "Animation/AnimInstance.h"
 #include "Components/TextRenderComponent.h"
 #include "Materials/Material.h"
 #include "GameFramework/Controller.h"
+#include "GoKartMovementComponent.h"
+#include "KrazyKartsVehicleSubsystem.h"
+#include "KrazyKartsMatchSubsystem.h"
+#include "GoKartSurfaceSubsystem.h"
+#include "KrazyKartsTrackProgressSubsystem.h"
+#include "SkeletalMeshComponentBudgeted.h"
+
+#if WITH_PHYSX_VEHICLES
+#include "PhysXPublic.h"
+#endif // WITH_PHYSX_VEHICLES
 
 #ifndef HMD_MODULE_INCLUDED
 #define HMD_MODULE_INCLUDED 0
@@ -29,18 +42,30 @@
 const FName AKrazyKartsPawn::LookUpBinding("LookUp");
 const FName AKrazyKartsPawn::LookRightBinding("LookRight");
 
+FName AKrazyKartsPawn::SpringArmComponentName(TEXT("SpringArm0"));
+FName AKrazyKartsPawn::CameraComponentName(TEXT("Camera0"));
+FName AKrazyKartsPawn::InternalCameraBaseComponentName(TEXT("InternalCameraBase"));
+FName AKrazyKartsPawn::InternalCameraComponentName(TEXT("InternalCamera"));
+FName AKrazyKartsPawn::InCarSpeedComponentName(TEXT("IncarSpeed"));
+FName AKrazyKartsPawn::InCarGearComponentName(TEXT("IncarGear"));
+
 #define LOCTEXT_NAMESPACE "VehiclePawn"
 
 PRAGMA_DISABLE_DEPRECATION_WARNINGS
 
-AKrazyKartsPawn::AKrazyKartsPawn()
+AKrazyKartsPawn::AKrazyKartsPawn(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer
+		.SetDefaultSubobjectClass<USkeletalMeshComponentBudgeted>(AWheeledVehicle::VehicleMeshComponentName)
+		.SetDefaultSubobjectClass<UKrazyKartsVehicleMovementComponent>(AWheeledVehicle::VehicleMovementComponentName))
 {
-	// Car mesh
-	static ConstructorHelpers::FObjectFinder<USkeletalMesh> CarMesh(TEXT("/Game/Vehicle/Sedan/Sedan_SkelMesh.Sedan_SkelMesh"));
-	GetMesh()->SetSkeletalMesh(CarMesh.Object);
-
-	static ConstructorHelpers::FClassFinder<UObject> AnimBPClass(TEXT("/Game/Vehicle/Sedan/Sedan_AnimBP"));
-	GetMesh()->SetAnimInstanceClass(AnimBPClass.Class);
+	// Car mesh and animation. Soft references, so the class default object doesn't pull them in at startup. See RequestVisuals
+	CarMesh = TSoftObjectPtr<USkeletalMesh>(FSoftObjectPath(TEXT("/Game/Vehicle/Sedan/Sedan_SkelMesh.Sedan_SkelMesh")));
+	CarAnimClass = TSoftClassPtr<UAnimInstance>(FSoftObjectPath(TEXT("/Game/Vehicle/Sedan/Sedan_AnimBP.Sedan_AnimBP_C")));
+
+	// Distant karts skip wheel animation frames and interpolate the skipped ones.
+	// While the animation budget allocator is enabled it takes over, with the significance from UKrazyKartsVehicleSubsystem
+	GetMesh()->bEnableUpdateRateOptimizations = true;
+	CastChecked<USkeletalMeshComponentBudgeted>(GetMesh())->SetAutoCalculateSignificance(false);
 	
 	// Simulation
 	UWheeledVehicleMovementComponent4W* Vehicle4W = CastChecked<UWheeledVehicleMovementComponent4W>(GetVehicleMovement());
@@ -63,55 +88,75 @@ AKrazyKartsPawn::AKrazyKartsPawn()
 	Vehicle4W->WheelSetups[3].BoneName = FName("Wheel_Rear_Right");
 	Vehicle4W->WheelSetups[3].AdditionalOffset = FVector(0.f, 12.f, 0.f);
 
-	// Create a spring arm component
-	SpringArm = CreateDefaultSubobject<USpringArmComponent>(TEXT("SpringArm0"));
-	SpringArm->TargetOffset = FVector(0.f, 0.f, 200.f);
-	SpringArm->SetRelativeRotation(FRotator(-15.f, 0.f, 0.f));
-	SpringArm->SetupAttachment(RootComponent);
-	SpringArm->TargetArmLength = 600.0f;
-	SpringArm->bEnableCameraRotationLag = true;
-	SpringArm->CameraRotationLagSpeed = 7.f;
-	SpringArm->bInheritPitch = false;
-	SpringArm->bInheritRoll = false;
-
-	// Create camera component 
-	Camera = CreateDefaultSubobject<UCameraComponent>(TEXT("Camera0"));
-	Camera->SetupAttachment(SpringArm, USpringArmComponent::SocketName);
-	Camera->bUsePawnControlRotation = false;
-	Camera->FieldOfView = 90.f;
+	// Kinematic model for when we are far away. The pawn drives it from Tick, and it must not take over collision between PhysX vehicles
+	KinematicMovement = CreateDefaultSubobject<UGoKartMovementComponent>(TEXT("KinematicMovement"));
+	KinematicMovement->PrimaryComponentTick.bStartWithTickEnabled = false;
+	KinematicMovement->SetUseKartBroadphase(false);
 
-	// Create In-Car camera component 
+	// Offset of the In-Car camera
 	InternalCameraOrigin = FVector(0.0f, -40.0f, 120.0f);
 
-	InternalCameraBase = CreateDefaultSubobject<USceneComponent>(TEXT("InternalCameraBase"));
-	InternalCameraBase->SetRelativeLocation(InternalCameraOrigin);
-	InternalCameraBase->SetupAttachment(GetMesh());
+	//Setup TextRenderMaterial, it is applied once streamed in
+	TextMaterial = TSoftObjectPtr<UMaterialInterface>(FSoftObjectPath(TEXT("/Engine/EngineMaterials/AntiAliasedTextMaterialTranslucent.AntiAliasedTextMaterialTranslucent")));
+
+	// Cameras and in-car text are presentation only and optional, AKrazyKartsServerPawn leaves them out. Every use checks for that
+	SpringArm = CreateOptionalDefaultSubobject<USpringArmComponent>(SpringArmComponentName);
+	if (SpringArm != nullptr)
+	{
+		SpringArm->TargetOffset = FVector(0.f, 0.f, 200.f);
+		SpringArm->SetRelativeRotation(FRotator(-15.f, 0.f, 0.f));
+		SpringArm->SetupAttachment(RootComponent);
+		SpringArm->TargetArmLength = 600.0f;
+		SpringArm->bEnableCameraRotationLag = true;
+		SpringArm->CameraRotationLagSpeed = 7.f;
+		SpringArm->bInheritPitch = false;
+		SpringArm->bInheritRoll = false;
+	}
 
-	InternalCamera = CreateDefaultSubobject<UCameraComponent>(TEXT("InternalCamera"));
-	InternalCamera->bUsePawnControlRotation = false;
-	InternalCamera->FieldOfView = 90.f;
-	InternalCamera->SetupAttachment(InternalCameraBase);
+	// Create camera component 
+	Camera = CreateOptionalDefaultSubobject<UCameraComponent>(CameraComponentName);
+	if (Camera != nullptr)
+	{
+		Camera->SetupAttachment(SpringArm, USpringArmComponent::SocketName);
+		Camera->bUsePawnControlRotation = false;
+		Camera->FieldOfView = 90.f;
+	}
 
-	//Setup TextRenderMaterial
-	static ConstructorHelpers::FObjectFinder<UMaterial> TextMaterial(TEXT("Material'/Engine/EngineMaterials/AntiAliasedTextMaterialTranslucent.AntiAliasedTextMaterialTranslucent'"));
-	
-	UMaterialInterface* Material = TextMaterial.Object;
+	// Create In-Car camera component 
+	InternalCameraBase = CreateOptionalDefaultSubobject<USceneComponent>(InternalCameraBaseComponentName);
+	if (InternalCameraBase != nullptr)
+	{
+		InternalCameraBase->SetRelativeLocation(InternalCameraOrigin);
+		InternalCameraBase->SetupAttachment(GetMesh());
+	}
+
+	InternalCamera = CreateOptionalDefaultSubobject<UCameraComponent>(InternalCameraComponentName);
+	if (InternalCamera != nullptr)
+	{
+		InternalCamera->bUsePawnControlRotation = false;
+		InternalCamera->FieldOfView = 90.f;
+		InternalCamera->SetupAttachment(InternalCameraBase);
+	}
 
 	// Create text render component for in car speed display
-	InCarSpeed = CreateDefaultSubobject<UTextRenderComponent>(TEXT("IncarSpeed"));
-	InCarSpeed->SetTextMaterial(Material);
-	InCarSpeed->SetRelativeLocation(FVector(70.0f, -75.0f, 99.0f));
-	InCarSpeed->SetRelativeRotation(FRotator(18.0f, 180.0f, 0.0f));
-	InCarSpeed->SetupAttachment(GetMesh());
-	InCarSpeed->SetRelativeScale3D(FVector(1.0f, 0.4f, 0.4f));
+	InCarSpeed = CreateOptionalDefaultSubobject<UTextRenderComponent>(InCarSpeedComponentName);
+	if (InCarSpeed != nullptr)
+	{
+		InCarSpeed->SetRelativeLocation(FVector(70.0f, -75.0f, 99.0f));
+		InCarSpeed->SetRelativeRotation(FRotator(18.0f, 180.0f, 0.0f));
+		InCarSpeed->SetupAttachment(GetMesh());
+		InCarSpeed->SetRelativeScale3D(FVector(1.0f, 0.4f, 0.4f));
+	}
 
 	// Create text render component for in car gear display
-	InCarGear = CreateDefaultSubobject<UTextRenderComponent>(TEXT("IncarGear"));
-	InCarGear->SetTextMaterial(Material);
-	InCarGear->SetRelativeLocation(FVector(66.0f, -9.0f, 95.0f));	
-	InCarGear->SetRelativeRotation(FRotator(25.0f, 180.0f,0.0f));
-	InCarGear->SetRelativeScale3D(FVector(1.0f, 0.4f, 0.4f));
-	InCarGear->SetupAttachment(GetMesh());
+	InCarGear = CreateOptionalDefaultSubobject<UTextRenderComponent>(InCarGearComponentName);
+	if (InCarGear != nullptr)
+	{
+		InCarGear->SetRelativeLocation(FVector(66.0f, -9.0f, 95.0f));	
+		InCarGear->SetRelativeRotation(FRotator(25.0f, 180.0f,0.0f));
+		InCarGear->SetRelativeScale3D(FVector(1.0f, 0.4f, 0.4f));
+		InCarGear->SetupAttachment(GetMesh());
+	}
 	
 	// Colors for the incar gear display. One for normal one for reverse
 	GearDisplayReverseColor = FColor(255, 0, 0, 255);
@@ -170,6 +215,11 @@ void AKrazyKartsPawn::OnToggleCamera()
 
 void AKrazyKartsPawn::EnableIncarView(const bool bState, const bool bForce)
 {
+	if ((Camera == nullptr) || (InternalCamera == nullptr))
+	{
+		return; // Server kart without cameras
+	}
+
 	if ((bState != bInCarCameraActive) || ( bForce == true ))
 	{
 		bInCarCameraActive = bState;
@@ -186,16 +236,91 @@ void AKrazyKartsPawn::EnableIncarView(const bool bState, const bool bForce)
 			Camera->Activate();
 		}
 		
-		InCarSpeed->SetVisibility(bInCarCameraActive);
-		InCarGear->SetVisibility(bInCarCameraActive);
+		if (InCarSpeed != nullptr)
+		{
+			InCarSpeed->SetVisibility(bInCarCameraActive);
+		}
+		if (InCarGear != nullptr)
+		{
+			InCarGear->SetVisibility(bInCarCameraActive);
+		}
 	}
 }
 
 
+void AKrazyKartsPawn::SetSimulationLOD(EKrazyKartsSimulationLOD NewLOD)
+{
+	if (NewLOD == SimulationLOD) return;
+
+	SimulationLOD = NewLOD;
+
+	UWheeledVehicleMovementComponent* VehicleMovement = GetVehicleMovementComponent();
+
+	if (SimulationLOD == EKrazyKartsSimulationLOD::Kinematic)
+	{
+		FVector LinearVelocity = GetMesh()->GetPhysicsLinearVelocity();
+
+		// Removes the vehicle from the PhysX vehicle manager, so its wheel raycasts and substeps stop as well
+		VehicleMovement->DestroyPhysicsState();
+		VehicleMovement->SetComponentTickEnabled(false);
+		GetMesh()->SetSimulatePhysics(false);
+
+		// The kinematic model only yaws, and works in m/s
+		SetActorRotation(FRotator(0.f, GetActorRotation().Yaw, 0.f));
+		KinematicMovement->SetVelocity(LinearVelocity / 100.f);
+	}
+	else
+	{
+		FVector LinearVelocity = KinematicMovement->GetVelocity() * 100.f;
+
+		GetMesh()->SetSimulatePhysics(true);
+		VehicleMovement->RecreatePhysicsState();
+		VehicleMovement->SetComponentTickEnabled(true);
+		WheelSubsteps = 0; // The new PhysX vehicle starts with the default substeps
+
+		GetMesh()->SetPhysicsLinearVelocity(LinearVelocity);
+	}
+}
+
+void AKrazyKartsPawn::SetWheelSubsteps(int32 Substeps)
+{
+	if (Substeps == WheelSubsteps) return;
+
+#if WITH_PHYSX_VEHICLES
+	physx::PxVehicleWheels* PVehicle = GetVehicleMovementComponent()->PVehicle;
+	if (PVehicle == nullptr) return; // Physics state not created yet, try again next frame
+
+	// Same count on both sides of the threshold, the speed based choice is made by the vehicle subsystem
+	PVehicle->mWheelsSimData.setSubStepCount(0.f, Substeps, Substeps);
+#endif // WITH_PHYSX_VEHICLES
+
+	WheelSubsteps = Substeps;
+}
+
 void AKrazyKartsPawn::Tick(float Delta)
 {
 	Super::Tick(Delta);
 
+	FKrazyKartsMatchTickScope MatchTickScope(this);
+
+	if (SimulationLOD == EKrazyKartsSimulationLOD::Kinematic)
+	{
+		// Remote players and AI drive through the vehicle movement too, not through our input bindings
+		FGoKartMove Move;
+		CastChecked<UKrazyKartsVehicleMovementComponent>(GetVehicleMovementComponent())->GetDriverInputs(Move.Throttle, Move.SteeringThrow);
+		Move.DeltaTime = Delta;
+		Move.Sequence = 0; // Never replicated, nothing to acknowledge
+		KinematicMovement->SimulateMove(Move);
+	}
+
+	UpdatePhysicsMaterial();
+
+	// Everything below is presentation, nobody sees it on a dedicated server
+	if (GetNetMode() == NM_DedicatedServer)
+	{
+		return;
+	}
+
 	// Setup the flag to say we are in reverse gear
 	bInReverseGear = GetVehicleMovement()->GetCurrentGear() < 0;
 	
@@ -214,7 +339,7 @@ void AKrazyKartsPawn::Tick(float Delta)
 #endif // HMD_MODULE_INCLUDED
 	if (bHMDActive == false)
 	{
-		if ( (InputComponent) && (bInCarCameraActive == true ))
+		if ( (InputComponent) && (bInCarCameraActive == true ) && (InternalCamera != nullptr))
 		{
 			FRotator HeadRotation = InternalCamera->GetRelativeRotation();
 			HeadRotation.Pitch += InputComponent->GetAxisValue(LookUpBinding);
@@ -224,21 +349,144 @@ void AKrazyKartsPawn::Tick(float Delta)
 	}
 }
 
+void AKrazyKartsPawn::UpdatePhysicsMaterial()
+{
+	const UGoKartSurfaceSubsystem* SurfaceSubsystem = GetWorld()->GetSubsystem<UGoKartSurfaceSubsystem>();
+	if (SurfaceSubsystem == nullptr) return;
+
+	FGoKartSurfaceCell Surface = SurfaceSubsystem->GetSurface(GetActorLocation());
+	bIsLowFriction = Surface.GetFriction() < SurfaceSubsystem->LowFrictionThreshold;
+
+	// The kinematic model reads the grid itself
+	UPrimitiveComponent* Body = GetMesh();
+	if (SimulationLOD != EKrazyKartsSimulationLOD::Full || !Body->IsSimulatingPhysics()) return;
+
+	float ExtraScale = SurfaceSubsystem->GetRollingResistanceScale(Surface.SurfaceType) - 1.f;
+	if (ExtraScale <= 0.f) return;
+
+	FVector Velocity = Body->GetPhysicsLinearVelocity();
+	float NormalForce = Body->GetMass() * -GetWorld()->GetGravityZ(); // kg cm/s^2, the unit AddForce takes
+	Body->AddForce(-Velocity.GetSafeNormal() * SurfaceRollingResistanceCoefficient * ExtraScale * NormalForce);
+}
+
+bool AKrazyKartsPawn::IsNetRelevantFor(const AActor* RealViewer, const AActor* ViewTarget, const FVector& SrcLocation) const
+{
+	// Vehicles of another match on this server are never sent, however close their track is
+	const UKrazyKartsMatchSubsystem* MatchSubsystem = GetWorld()->GetSubsystem<UKrazyKartsMatchSubsystem>();
+	if (MatchSubsystem != nullptr && !MatchSubsystem->AreInSameMatch(this, RealViewer)) return false;
+
+	return Super::IsNetRelevantFor(RealViewer, ViewTarget, SrcLocation);
+}
+
+float AKrazyKartsPawn::GetNetPriority(const FVector& ViewPos, const FVector& ViewDir, AActor* Viewer, AActor* ViewTarget, UActorChannel* InChannel, float Time, bool bLowBandwidth)
+{
+	float Priority = Super::GetNetPriority(ViewPos, ViewDir, Viewer, ViewTarget, InChannel, Time, bLowBandwidth);
+
+	// Vehicles fighting for positions with the viewer matter more than distance alone says
+	const UKrazyKartsTrackProgressSubsystem* TrackProgress = GetWorld()->GetSubsystem<UKrazyKartsTrackProgressSubsystem>();
+	return TrackProgress != nullptr ? Priority * TrackProgress->GetNetPriorityScale(this, ViewTarget) : Priority;
+}
+
+void AKrazyKartsPawn::FellOutOfWorld(const UDamageType& DamageType)
+{
+	// Back into the pool and onto a start spot, rather than destroying a vehicle the pool would have to replace.
+	// Clients leave it to the server, hiding it here would outlast the respawn
+	if (!HasAuthority()) return;
+
+	AKrazyKartsGameMode* GameMode = GetWorld()->GetAuthGameMode<AKrazyKartsGameMode>();
+	if (GameMode != nullptr && GetController() != nullptr)
+	{
+		GameMode->RespawnPlayer(GetController());
+		return;
+	}
+
+	Super::FellOutOfWorld(DamageType);
+}
+
 void AKrazyKartsPawn::BeginPlay()
 {
 	Super::BeginPlay();
 
+	RequestVisuals();
+
 	bool bEnableInCar = false;
 #if HMD_MODULE_INCLUDED
 	bEnableInCar = UHeadMountedDisplayFunctionLibrary::IsHeadMountedDisplayEnabled();
 #endif // HMD_MODULE_INCLUDED
 	EnableIncarView(bEnableInCar,true);
+
+	UKrazyKartsVehicleSubsystem* VehicleSubsystem = GetWorld()->GetSubsystem<UKrazyKartsVehicleSubsystem>();
+	if (VehicleSubsystem != nullptr)
+	{
+		VehicleSubsystem->RegisterVehicle(this);
+	}
+
+	UKrazyKartsTrackProgressSubsystem* TrackProgress = GetWorld()->GetSubsystem<UKrazyKartsTrackProgressSubsystem>();
+	if (TrackProgress != nullptr)
+	{
+		TrackProgress->RegisterKart(this);
+	}
+}
+
+void AKrazyKartsPawn::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	UKrazyKartsVehicleSubsystem* VehicleSubsystem = GetWorld()->GetSubsystem<UKrazyKartsVehicleSubsystem>();
+	if (VehicleSubsystem != nullptr)
+	{
+		VehicleSubsystem->UnregisterVehicle(this);
+	}
+
+	UKrazyKartsTrackProgressSubsystem* TrackProgress = GetWorld()->GetSubsystem<UKrazyKartsTrackProgressSubsystem>();
+	if (TrackProgress != nullptr)
+	{
+		TrackProgress->UnregisterKart(this);
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void AKrazyKartsPawn::RequestVisuals()
+{
+	TArray<FSoftObjectPath> Assets;
+	Assets.Add(CarMesh.ToSoftObjectPath());
+
+	// Nobody looks at the wheels or the in-car text on a dedicated server
+	if (GetNetMode() != NM_DedicatedServer)
+	{
+		Assets.Add(CarAnimClass.ToSoftObjectPath());
+		Assets.Add(TextMaterial.ToSoftObjectPath());
+	}
+
+	VisualsHandle = UAssetManager::GetStreamableManager().RequestAsyncLoad(Assets, FStreamableDelegate::CreateUObject(this, &AKrazyKartsPawn::OnVisualsLoaded));
+}
+
+void AKrazyKartsPawn::OnVisualsLoaded()
+{
+	if (GetNetMode() != NM_DedicatedServer)
+	{
+		GetMesh()->SetAnimInstanceClass(CarAnimClass.Get());
+	}
+
+	if ((InCarSpeed != nullptr) && (InCarGear != nullptr))
+	{
+		InCarSpeed->SetTextMaterial(TextMaterial.Get());
+		InCarGear->SetTextMaterial(TextMaterial.Get());
+	}
+
+	GetMesh()->SetSkeletalMesh(CarMesh.Get());
+
+	// Without a mesh there was no body to build the PhysX vehicle on, so build it now
+	if (SimulationLOD == EKrazyKartsSimulationLOD::Full)
+	{
+		GetVehicleMovementComponent()->RecreatePhysicsState();
+		WheelSubsteps = 0;
+	}
 }
 
 void AKrazyKartsPawn::OnResetVR()
 {
 #if HMD_MODULE_INCLUDED
-	if (GEngine->XRSystem.IsValid())
+	if (GEngine->XRSystem.IsValid() && (InternalCamera != nullptr))
 	{
 		GEngine->XRSystem->ResetOrientationAndPosition();
 		InternalCamera->SetRelativeLocation(InternalCameraOrigin);
@@ -252,16 +500,23 @@ void AKrazyKartsPawn::UpdateHUDStrings()
 	float KPH = FMath::Abs(GetVehicleMovement()->GetForwardSpeed()) * 0.036f;
 	int32 KPH_int = FMath::FloorToInt(KPH);
 
-	// Using FText because this is display text that should be localizable
-	SpeedDisplayString = FText::Format(LOCTEXT("SpeedFormat", "{0} km/h"), FText::AsNumber(KPH_int));
-	
+	// Using FText because this is display text that should be localizable. Formatting it allocates, so only do it when the number changed
+	if (KPH_int != DisplayedKPH)
+	{
+		SpeedDisplayString = FText::Format(LOCTEXT("SpeedFormat", "{0} km/h"), FText::AsNumber(KPH_int));
+		DisplayedKPH = KPH_int;
+	}
+
+	int32 Gear = GetVehicleMovement()->GetCurrentGear();
+	if (Gear == DisplayedGear) return;
+	DisplayedGear = Gear;
+
 	if (bInReverseGear == true)
 	{
 		GearDisplayString = FText(LOCTEXT("ReverseGear", "R"));
 	}
 	else
 	{
-		int32 Gear = GetVehicleMovement()->GetCurrentGear();
 		GearDisplayString = (Gear == 0) ? LOCTEXT("N", "N") : FText::AsNumber(Gear);
 	}	
 }
@@ -271,17 +526,20 @@ void AKrazyKartsPawn::SetupInCarHUD()
 	APlayerController* PlayerController = Cast<APlayerController>(GetController());
 	if ((PlayerController != nullptr) && (InCarSpeed != nullptr) && (InCarGear != nullptr) )
 	{
-		// Setup the text render component strings
-		InCarSpeed->SetText(SpeedDisplayString);
-		InCarGear->SetText(GearDisplayString);
-		
-		if (bInReverseGear == false)
+		// Setup the text render component strings. Each set recreates the render state, so only when they were rebuilt
+		if (!InCarSpeed->Text.IdenticalTo(SpeedDisplayString))
 		{
-			InCarGear->SetTextRenderColor(GearDisplayColor);
+			InCarSpeed->SetText(SpeedDisplayString);
 		}
-		else
+		if (!InCarGear->Text.IdenticalTo(GearDisplayString))
+		{
+			InCarGear->SetText(GearDisplayString);
+		}
+		
+		FColor GearColor = bInReverseGear == false ? GearDisplayColor : GearDisplayReverseColor;
+		if (InCarGear->TextRenderColor != GearColor)
 		{
-			InCarGear->SetTextRenderColor(GearDisplayReverseColor);
+			InCarGear->SetTextRenderColor(GearColor);
 		}
 	}
 }
@@ -4,12 +4,27 @@
 
 #include "CoreMinimal.h"
 #include "WheeledVehicle.h"
+#include "Engine/StreamableManager.h"
 #include "KrazyKartsPawn.generated.h"
 
 class UCameraComponent;
 class USpringArmComponent;
 class UTextRenderComponent;
 class UInputComponent;
+class UGoKartMovementComponent;
+class USkeletalMesh;
+class UAnimInstance;
+class UMaterialInterface;
+
+/** How much simulation a vehicle currently gets, picked by UKrazyKartsVehicleSubsystem */
+UENUM()
+enum class EKrazyKartsSimulationLOD : uint8
+{
+	/** Full PhysX wheeled vehicle */
+	Full,
+	/** Cheap force model of UGoKartMovementComponent, for distant vehicles */
+	Kinematic
+};
 
 PRAGMA_DISABLE_DEPRECATION_WARNINGS
 
@@ -42,9 +57,13 @@ class AKrazyKartsPawn : public AWheeledVehicle
 	UPROPERTY(Category = Display, VisibleDefaultsOnly, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
 	UTextRenderComponent* InCarGear;
 
+	/** Kinematic movement used instead of the PhysX vehicle while far away from every viewer */
+	UPROPERTY(Category = Vehicle, VisibleDefaultsOnly, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	UGoKartMovementComponent* KinematicMovement;
+
 	
 public:
-	AKrazyKartsPawn();
+	AKrazyKartsPawn(const FObjectInitializer& ObjectInitializer);
 
 	/** The current speed as a string eg 10 km/h */
 	UPROPERTY(Category = Display, VisibleDefaultsOnly, BlueprintReadOnly)
@@ -70,6 +89,22 @@ public:
 	UPROPERTY(Category = Camera, VisibleDefaultsOnly, BlueprintReadOnly)
 	bool bInReverseGear;
 
+	/** Car mesh, streamed in at BeginPlay. Servers need it too, its physics asset is the vehicle body */
+	UPROPERTY(Category = Visuals, EditDefaultsOnly)
+	TSoftObjectPtr<USkeletalMesh> CarMesh;
+
+	/** Wheel animation, streamed in at BeginPlay. Never loaded on a dedicated server */
+	UPROPERTY(Category = Visuals, EditDefaultsOnly)
+	TSoftClassPtr<UAnimInstance> CarAnimClass;
+
+	/** Material of the in-car text, streamed in at BeginPlay. Never loaded on a dedicated server */
+	UPROPERTY(Category = Visuals, EditDefaultsOnly)
+	TSoftObjectPtr<UMaterialInterface> TextMaterial;
+
+	/** Rolling resistance coefficient of the PhysX vehicle on a surface with a scale of 1. Only the part above that is added as a force, the tires already roll on the base surface */
+	UPROPERTY(Category = Vehicle, EditDefaultsOnly)
+	float SurfaceRollingResistanceCoefficient = 0.015f;
+
 	/** Initial offset of incar camera */
 	FVector InternalCameraOrigin;
 	// Begin Pawn interface
@@ -78,8 +113,12 @@ public:
 
 	// Begin Actor interface
 	virtual void Tick(float Delta) override;
+	virtual bool IsNetRelevantFor(const AActor* RealViewer, const AActor* ViewTarget, const FVector& SrcLocation) const override;
+	virtual float GetNetPriority(const FVector& ViewPos, const FVector& ViewDir, AActor* Viewer, AActor* ViewTarget, UActorChannel* InChannel, float Time, bool bLowBandwidth) override;
+	virtual void FellOutOfWorld(const UDamageType& DamageType) override;
 protected:
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 public:
 	// End Actor interface
@@ -89,7 +128,7 @@ public:
 	/** Setup the strings used on the hud */
 	void SetupInCarHUD();
 
-	/** Update the physics material used by the vehicle mesh */
+	/** Look up the surface below us in the baked grid, and add its extra rolling resistance to the PhysX vehicle */
 	void UpdatePhysicsMaterial();
 	/** Handle pressing right */
 	void MoveRight(float Val);
@@ -102,9 +141,24 @@ public:
 	/** Handle reset VR device */
 	void OnResetVR();
 
+	/** Switch between the PhysX vehicle and the kinematic model, handing the velocity over */
+	void SetSimulationLOD(EKrazyKartsSimulationLOD NewLOD);
+	EKrazyKartsSimulationLOD GetSimulationLOD() const { return SimulationLOD; }
+
+	/** Set how many substeps the PhysX vehicle uses for its wheels. Picked each frame by UKrazyKartsVehicleSubsystem */
+	void SetWheelSubsteps(int32 Substeps);
+
 	static const FName LookUpBinding;
 	static const FName LookRightBinding;
 
+	/** Names of the optional presentation components, for subclasses that don't create them */
+	static FName SpringArmComponentName;
+	static FName CameraComponentName;
+	static FName InternalCameraBaseComponentName;
+	static FName InternalCameraComponentName;
+	static FName InCarSpeedComponentName;
+	static FName InCarGearComponentName;
+
 private:
 	/** 
 	 * Activate In-Car camera. Enable camera and sets visibility of incar hud display
@@ -114,11 +168,32 @@ private:
 	 */
 	void EnableIncarView( const bool bState, const bool bForce = false );
 
-	/** Update the gear and speed strings */
+	/** Update the gear and speed strings, only rebuilt when the number they show changes */
 	void UpdateHUDStrings();
 
+	/** Values SpeedDisplayString and GearDisplayString were last built from */
+	int32 DisplayedKPH = INDEX_NONE;
+	int32 DisplayedGear = MIN_int32;
+
+	/** Start streaming the mesh, and unless we are a dedicated server the presentation only assets */
+	void RequestVisuals();
+
+	/** Apply the streamed assets to the components */
+	void OnVisualsLoaded();
+
+	/** Keeps the streamed assets loaded for as long as we are around */
+	TSharedPtr<FStreamableHandle> VisualsHandle;
+
 	/* Are we on a 'slippery' surface */
-	bool bIsLowFriction;
+	bool bIsLowFriction = false;
+
+	EKrazyKartsSimulationLOD SimulationLOD = EKrazyKartsSimulationLOD::Full;
+
+	/** Wheel substep count last handed to PhysX, 0 until the first call so it is always applied once */
+	int32 WheelSubsteps = 0;
+
+	// Ticks the HUD strings on their own, see Tests/GoKartTickAllocationTest.cpp
+	friend class FGoKartTickAllocationTest;
 
 
 public:
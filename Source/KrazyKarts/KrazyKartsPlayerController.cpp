@@ -0,0 +1,33 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "KrazyKartsPlayerController.h"
+#include "KrazyKartsGameMode.h"
+#include "KrazyKartsSpectatorSubsystem.h"
+#include "KrazyKartsMatchSubsystem.h"
+#include "Engine/GameInstance.h"
+#include "Engine/World.h"
+
+void AKrazyKartsPlayerController::PawnLeavingGame()
+{
+	// Give the pawn back to the pool rather than destroying it with us
+	AKrazyKartsGameMode* GameMode = GetWorld()->GetAuthGameMode<AKrazyKartsGameMode>();
+	if ((GameMode != nullptr) && (GetPawn() != nullptr))
+	{
+		GameMode->ReleasePawn(GetPawn());
+		return;
+	}
+
+	Super::PawnLeavingGame();
+}
+
+void AKrazyKartsPlayerController::SpectateRace(const FString& StreamName)
+{
+	GetGameInstance()->GetSubsystem<UKrazyKartsSpectatorSubsystem>()->Spectate(StreamName);
+}
+
+void AKrazyKartsPlayerController::ClientEnterMatch_Implementation(int32 MatchId)
+{
+	UKrazyKartsMatchSubsystem* MatchSubsystem = GetWorld()->GetSubsystem<UKrazyKartsMatchSubsystem>();
+	MatchSubsystem->SetActorMatch(this, MatchId);
+	MatchSubsystem->LoadMatchTrack(MatchId);
+}
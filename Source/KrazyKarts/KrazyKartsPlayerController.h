@@ -0,0 +1,23 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+#pragma once
+#include "GameFramework/PlayerController.h"
+#include "KrazyKartsPlayerController.generated.h"
+
+UCLASS()
+class AKrazyKartsPlayerController : public APlayerController
+{
+	GENERATED_BODY()
+
+public:
+	// Begin APlayerController interface
+	virtual void PawnLeavingGame() override;
+	// End APlayerController interface
+
+	/** Leaves the race and watches the live spectator stream, the default one if StreamName is empty */
+	UFUNCTION(Exec)
+	void SpectateRace(const FString& StreamName);
+
+	/** Tells the client which of the server's matches it plays in, so it streams in that match's track */
+	UFUNCTION(Client, Reliable)
+	void ClientEnterMatch(int32 MatchId);
+};
@@ -0,0 +1,64 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "KrazyKartsPooledPawnComponent.h"
+#include "Net/UnrealNetwork.h"
+#include "Components/PrimitiveComponent.h"
+#include "Engine/World.h"
+#include "TimerManager.h"
+
+UKrazyKartsPooledPawnComponent::UKrazyKartsPooledPawnComponent()
+{
+	PrimaryComponentTick.bCanEverTick = false;
+
+	SetIsReplicatedByDefault(true);
+}
+
+void UKrazyKartsPooledPawnComponent::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	DOREPLIFETIME(UKrazyKartsPooledPawnComponent, bInPool);
+}
+
+void UKrazyKartsPooledPawnComponent::BeginPlay()
+{
+	Super::BeginPlay();
+
+	// BeginPlay registers the tick functions of the actor and its components as their class defaults say, which undoes a pool
+	// state set before it. Pawns filled into the pool at map load, and the ones a client receives while pooled, apply it again
+	if (bInPool)
+	{
+		GetWorld()->GetTimerManager().SetTimerForNextTick(this, &UKrazyKartsPooledPawnComponent::ApplyPoolState);
+	}
+}
+
+void UKrazyKartsPooledPawnComponent::SetInPool(bool bNewInPool)
+{
+	bInPool = bNewInPool;
+	ApplyPoolState();
+}
+
+void UKrazyKartsPooledPawnComponent::OnRep_InPool()
+{
+	ApplyPoolState();
+}
+
+void UKrazyKartsPooledPawnComponent::ApplyPoolState()
+{
+	AActor* Owner = GetOwner();
+
+	UPrimitiveComponent* Root = Cast<UPrimitiveComponent>(Owner->GetRootComponent());
+	if (Root != nullptr)
+	{
+		// Without collision it would fall forever, and some classes start without physics on purpose
+		Root->SetSimulatePhysics(!bInPool && CastChecked<UPrimitiveComponent>(Root->GetArchetype())->BodyInstance.bSimulatePhysics);
+	}
+
+	Owner->SetActorHiddenInGame(bInPool);
+	Owner->SetActorEnableCollision(!bInPool);
+	Owner->SetActorTickEnabled(!bInPool && Owner->PrimaryActorTick.bStartWithTickEnabled);
+	for (UActorComponent* Component : Owner->GetComponents())
+	{
+		Component->SetComponentTickEnabled(!bInPool && Component->PrimaryComponentTick.bStartWithTickEnabled);
+	}
+}
@@ -0,0 +1,41 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/ActorComponent.h"
+#include "KrazyKartsPooledPawnComponent.generated.h"
+
+/**
+ * Marks a pawn as parked in AKrazyKartsGameMode's pawn pool, on every machine.
+ * The flag replicates, and each side hides the pawn and turns off its collision, physics and ticking from it.
+ * The game mode keeps pooled pawns relevant, so clients hold on to them and handing one out creates no actor anywhere.
+ */
+UCLASS()
+class KRAZYKARTS_API UKrazyKartsPooledPawnComponent : public UActorComponent
+{
+	GENERATED_BODY()
+
+public:
+	UKrazyKartsPooledPawnComponent();
+
+	void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+
+	/** Server side */
+	void SetInPool(bool bNewInPool);
+
+	bool IsInPool() const { return bInPool; }
+
+protected:
+	virtual void BeginPlay() override;
+
+private:
+	UFUNCTION()
+	void OnRep_InPool();
+
+	/** Hides the pawn and stops everything it does while in the pool, or restores what its class defaults say */
+	void ApplyPoolState();
+
+	UPROPERTY(ReplicatedUsing = OnRep_InPool)
+	bool bInPool = false;
+};
@@ -0,0 +1,25 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "KrazyKartsServerPawn.h"
+
+PRAGMA_DISABLE_DEPRECATION_WARNINGS
+
+static const FObjectInitializer& SkipPresentationComponents(const FObjectInitializer& ObjectInitializer)
+{
+	if (!IsRunningDedicatedServer()) return ObjectInitializer;
+
+	return ObjectInitializer
+		.DoNotCreateDefaultSubobject(AKrazyKartsPawn::SpringArmComponentName)
+		.DoNotCreateDefaultSubobject(AKrazyKartsPawn::CameraComponentName)
+		.DoNotCreateDefaultSubobject(AKrazyKartsPawn::InternalCameraBaseComponentName)
+		.DoNotCreateDefaultSubobject(AKrazyKartsPawn::InternalCameraComponentName)
+		.DoNotCreateDefaultSubobject(AKrazyKartsPawn::InCarSpeedComponentName)
+		.DoNotCreateDefaultSubobject(AKrazyKartsPawn::InCarGearComponentName);
+}
+
+AKrazyKartsServerPawn::AKrazyKartsServerPawn(const FObjectInitializer& ObjectInitializer)
+	: Super(SkipPresentationComponents(ObjectInitializer))
+{
+}
+
+PRAGMA_ENABLE_DEPRECATION_WARNINGS
@@ -0,0 +1,24 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "KrazyKartsPawn.h"
+#include "KrazyKartsServerPawn.generated.h"
+
+PRAGMA_DISABLE_DEPRECATION_WARNINGS
+
+/**
+ * The vehicle a dedicated server spawns for its players. The server never looks through the cameras or reads the in-car text,
+ * so it doesn't create them. Clients construct the same class through replication and keep theirs
+ */
+UCLASS(config=Game)
+class AKrazyKartsServerPawn : public AKrazyKartsPawn
+{
+	GENERATED_BODY()
+
+public:
+	AKrazyKartsServerPawn(const FObjectInitializer& ObjectInitializer);
+};
+
+PRAGMA_ENABLE_DEPRECATION_WARNINGS
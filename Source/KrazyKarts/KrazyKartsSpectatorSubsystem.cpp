@@ -0,0 +1,46 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "KrazyKartsSpectatorSubsystem.h"
+#include "Engine/GameInstance.h"
+#include "Engine/DemoNetDriver.h"
+#include "Engine/World.h"
+
+void UKrazyKartsSpectatorSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	ReplayStartedHandle = FNetworkReplayDelegates::OnReplayStarted.AddUObject(this, &UKrazyKartsSpectatorSubsystem::OnReplayStarted);
+}
+
+void UKrazyKartsSpectatorSubsystem::Deinitialize()
+{
+	FNetworkReplayDelegates::OnReplayStarted.Remove(ReplayStartedHandle);
+
+	Super::Deinitialize();
+}
+
+TArray<FString> UKrazyKartsSpectatorSubsystem::GetReplayOptions() const
+{
+	return { FString::Printf(TEXT("ReplayStreamerOverride=%s"), *ReplayStreamer) };
+}
+
+void UKrazyKartsSpectatorSubsystem::StartBroadcast()
+{
+	GetGameInstance()->StartRecordingReplay(StreamName, StreamName, GetReplayOptions());
+}
+
+void UKrazyKartsSpectatorSubsystem::Spectate(const FString& InStreamName)
+{
+	bSpectating = GetGameInstance()->PlayReplay(InStreamName.IsEmpty() ? StreamName : InStreamName, nullptr, GetReplayOptions());
+}
+
+void UKrazyKartsSpectatorSubsystem::OnReplayStarted(UWorld* World)
+{
+	if (!bSpectating || World == nullptr || World->GetGameInstance() != GetGameInstance()) return;
+	bSpectating = false;
+
+	UDemoNetDriver* DemoNetDriver = World->GetDemoNetDriver();
+	if (DemoNetDriver == nullptr) return;
+
+	DemoNetDriver->GotoTimeInSeconds(FMath::Max(0.f, DemoNetDriver->GetDemoTotalTime() - InterpolationDelay));
+}
@@ -0,0 +1,56 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/GameInstanceSubsystem.h"
+#include "KrazyKartsSpectatorSubsystem.generated.h"
+
+/**
+ * Lets any number of spectators watch a race without each of them costing the race server a connection.
+ * The server records the race as one live replay stream, a single extra net driver whatever the audience size.
+ * Spectators play that stream back a few seconds behind live, so the demo driver always has snapshots on both
+ * sides to interpolate between. The replay streamer does the fan out: the local file streamer for testing on
+ * one machine, or the http streamer pointed at a replay server that relays the stream to everyone.
+ */
+UCLASS(config = Game)
+class KRAZYKARTS_API UKrazyKartsSpectatorSubsystem : public UGameInstanceSubsystem
+{
+	GENERATED_BODY()
+
+public:
+
+	// Begin USubsystem interface
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	// End USubsystem interface
+
+	/** Server side. Starts recording the current race to the live stream */
+	void StartBroadcast();
+
+	/** Client side. Leaves the current game and watches the named live stream */
+	void Spectate(const FString& InStreamName);
+
+	/** Name of the live stream the server records and spectators join by default */
+	UPROPERTY(Config)
+	FString StreamName = TEXT("KrazyKartsLive");
+
+	/** Replay streaming module. LocalFileNetworkReplayStreaming for loopback testing, HttpNetworkReplayStreaming to go through a replay server */
+	UPROPERTY(Config)
+	FString ReplayStreamer = TEXT("LocalFileNetworkReplayStreaming");
+
+	/** How far behind live (s) spectators watch the race */
+	UPROPERTY(Config)
+	float InterpolationDelay = 3;
+
+private:
+
+	TArray<FString> GetReplayOptions() const;
+
+	/** Moves a spectator that just joined a live stream to InterpolationDelay behind its end */
+	void OnReplayStarted(UWorld* World);
+
+	FDelegateHandle ReplayStartedHandle;
+
+	bool bSpectating = false;
+};
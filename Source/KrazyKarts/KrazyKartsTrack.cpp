@@ -0,0 +1,37 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "KrazyKartsTrack.h"
+#include "KrazyKartsTrackProgressSubsystem.h"
+#include "Components/SplineComponent.h"
+#include "Engine/World.h"
+
+AKrazyKartsTrack::AKrazyKartsTrack()
+{
+	PrimaryActorTick.bCanEverTick = false;
+
+	Spline = CreateDefaultSubobject<USplineComponent>(TEXT("Spline"));
+	Spline->SetClosedLoop(true);
+	RootComponent = Spline;
+}
+
+void AKrazyKartsTrack::BeginPlay()
+{
+	Super::BeginPlay();
+
+	UKrazyKartsTrackProgressSubsystem* TrackProgress = GetWorld()->GetSubsystem<UKrazyKartsTrackProgressSubsystem>();
+	if (TrackProgress != nullptr)
+	{
+		TrackProgress->RegisterTrack(this);
+	}
+}
+
+void AKrazyKartsTrack::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	UKrazyKartsTrackProgressSubsystem* TrackProgress = GetWorld()->GetSubsystem<UKrazyKartsTrackProgressSubsystem>();
+	if (TrackProgress != nullptr)
+	{
+		TrackProgress->UnregisterTrack(this);
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
@@ -0,0 +1,38 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "KrazyKartsTrack.generated.h"
+
+class USplineComponent;
+
+/**
+ * The racing line of a track, as a closed spline running through the middle of the road in race direction.
+ * The first spline point is the start/finish line. UKrazyKartsTrackProgressSubsystem measures every kart along it.
+ */
+UCLASS()
+class KRAZYKARTS_API AKrazyKartsTrack : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	AKrazyKartsTrack();
+
+	USplineComponent* GetSpline() const { return Spline; }
+
+	float GetSegmentLength() const { return SegmentLength; }
+
+protected:
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+private:
+	UPROPERTY(Category = Track, VisibleAnywhere)
+	USplineComponent* Spline;
+
+	/** Length of the straight segments the spline is cut into for progress tracking (cm). Shorter follows tight corners better */
+	UPROPERTY(Category = Track, EditAnywhere)
+	float SegmentLength = 500;
+};
@@ -0,0 +1,382 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "KrazyKartsTrackProgressSubsystem.h"
+#include "KrazyKarts.h"
+#include "KrazyKartsTrack.h"
+#include "Components/SplineComponent.h"
+#include "GameFramework/Pawn.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+#include "Algo/BinarySearch.h"
+
+DECLARE_CYCLE_STAT(TEXT("Track Progress"), STAT_TrackProgress, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Track Segment Steps"), STAT_TrackSegmentSteps, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Track Resyncs"), STAT_TrackResyncs, STATGROUP_KrazyKarts);
+
+static FAutoConsoleCommandWithWorldAndArgs BenchmarkTrackProgressCommand(
+	TEXT("KrazyKarts.BenchmarkTrackProgress"),
+	TEXT("KrazyKarts.BenchmarkTrackProgress <Karts> <Frames>. Compares incremental race progress tracking with a full search, on the first track of the level"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UKrazyKartsTrackProgressSubsystem* TrackProgress = World != nullptr ? World->GetSubsystem<UKrazyKartsTrackProgressSubsystem>() : nullptr;
+		if (TrackProgress != nullptr)
+		{
+			int32 NumKarts = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 128;
+			int32 NumFrames = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 600;
+			TrackProgress->RunBenchmark(FMath::Max(1, NumKarts), FMath::Max(1, NumFrames));
+		}
+	}));
+
+/** Where Location falls along the segment, 0 at its start and 1 at its end */
+static float ProjectOnSegment(const FKrazyKartsTrackIndex::FSegment& Segment, const FVector& Location)
+{
+	return FVector::DotProduct(Location - Segment.Start, Segment.Direction) / Segment.Length;
+}
+
+static float DistSquaredToSegment(const FKrazyKartsTrackIndex::FSegment& Segment, const FVector& Location)
+{
+	float Alpha = FMath::Clamp(ProjectOnSegment(Segment, Location), 0.f, 1.f);
+	return FVector::DistSquared(Segment.Start + Segment.Direction * (Alpha * Segment.Length), Location);
+}
+
+/** Insertion sort, leader first. Cheap as long as only a few karts swapped places since the last call */
+static void SortByRaceDistance(TArray<int32>& Leaderboard, TArray<FKrazyKartsKartProgress>& Karts)
+{
+	for (int32 i = 1; i < Leaderboard.Num(); ++i)
+	{
+		for (int32 j = i; j > 0 && Karts[Leaderboard[j]].RaceDistance > Karts[Leaderboard[j - 1]].RaceDistance; --j)
+		{
+			Swap(Leaderboard[j], Leaderboard[j - 1]);
+		}
+	}
+
+	for (int32 i = 0; i < Leaderboard.Num(); ++i)
+	{
+		Karts[Leaderboard[i]].Position = i + 1;
+	}
+}
+
+void UKrazyKartsTrackProgressSubsystem::RegisterTrack(AKrazyKartsTrack* Track)
+{
+	USplineComponent* Spline = Track->GetSpline();
+	float SplineLength = Spline->GetSplineLength();
+	int32 NumSegments = FMath::Max(3, FMath::CeilToInt(SplineLength / FMath::Max(Track->GetSegmentLength(), 1.f)));
+
+	FKrazyKartsTrackIndex& TrackIndex = Tracks.AddDefaulted_GetRef();
+	TrackIndex.Track = Track;
+	TrackIndex.Segments.Reserve(NumSegments);
+
+	FVector Start = Spline->GetLocationAtDistanceAlongSpline(0.f, ESplineCoordinateSpace::World);
+	for (int32 i = 0; i < NumSegments; ++i)
+	{
+		FVector End = Spline->GetLocationAtDistanceAlongSpline(SplineLength * (i + 1) / NumSegments, ESplineCoordinateSpace::World);
+
+		FKrazyKartsTrackIndex::FSegment Segment;
+		Segment.Start = Start;
+		Segment.Length = FMath::Max(FVector::Dist(Start, End), KINDA_SMALL_NUMBER);
+		Segment.Direction = (End - Start) / Segment.Length;
+		Segment.Distance = TrackIndex.Length;
+		TrackIndex.Segments.Add(Segment);
+
+		TrackIndex.Length += Segment.Length;
+		Start = End;
+	}
+}
+
+void UKrazyKartsTrackProgressSubsystem::UnregisterTrack(AKrazyKartsTrack* Track)
+{
+	int32 TrackIndex = Tracks.IndexOfByPredicate([Track](const FKrazyKartsTrackIndex& Index) { return Index.Track == Track; });
+	if (TrackIndex == INDEX_NONE) return;
+
+	// Track indices shift, so everybody starts over. Only happens when a level is unloaded
+	for (FKrazyKartsKartProgress& Progress : Karts)
+	{
+		Progress.Track = INDEX_NONE;
+		Progress.Segment = INDEX_NONE;
+		Progress.Position = 0;
+	}
+
+	Tracks.RemoveAt(TrackIndex);
+	for (FKrazyKartsTrackIndex& Index : Tracks)
+	{
+		Index.Leaderboard.Reset();
+	}
+}
+
+void UKrazyKartsTrackProgressSubsystem::RegisterKart(APawn* Kart)
+{
+	if (Kart == nullptr || KartIndices.Contains(Kart)) return;
+
+	FKrazyKartsKartProgress& Progress = Karts.AddDefaulted_GetRef();
+	Progress.Kart = Kart;
+	KartIndices.Add(Kart, Karts.Num() - 1);
+}
+
+void UKrazyKartsTrackProgressSubsystem::UnregisterKart(APawn* Kart)
+{
+	int32 KartIndex;
+	if (!KartIndices.RemoveAndCopyValue(Kart, KartIndex)) return;
+
+	RemoveFromLeaderboard(KartIndex);
+
+	int32 LastIndex = Karts.Num() - 1;
+	Karts.RemoveAtSwap(KartIndex);
+	if (KartIndex == LastIndex) return;
+
+	// The last kart moved into the gap, fix up everything that refers to it by index
+	FKrazyKartsKartProgress& Moved = Karts[KartIndex];
+	KartIndices.Add(Moved.Kart, KartIndex);
+	if (Moved.Track != INDEX_NONE)
+	{
+		int32 LeaderboardIndex = Tracks[Moved.Track].Leaderboard.Find(LastIndex);
+		Tracks[Moved.Track].Leaderboard[LeaderboardIndex] = KartIndex;
+	}
+}
+
+void UKrazyKartsTrackProgressSubsystem::RemoveFromLeaderboard(int32 KartIndex)
+{
+	FKrazyKartsKartProgress& Progress = Karts[KartIndex];
+	if (Progress.Track == INDEX_NONE) return;
+
+	Tracks[Progress.Track].Leaderboard.Remove(KartIndex);
+	Progress.Track = INDEX_NONE;
+	Progress.Position = 0;
+}
+
+const FKrazyKartsKartProgress* UKrazyKartsTrackProgressSubsystem::GetProgress(const APawn* Kart) const
+{
+	const int32* KartIndex = KartIndices.Find(Kart);
+	if (KartIndex == nullptr || Karts[*KartIndex].Track == INDEX_NONE) return nullptr;
+
+	return &Karts[*KartIndex];
+}
+
+int32 UKrazyKartsTrackProgressSubsystem::GetNumRacers(const FKrazyKartsKartProgress& Progress) const
+{
+	return Tracks.IsValidIndex(Progress.Track) ? Tracks[Progress.Track].Leaderboard.Num() : 0;
+}
+
+float UKrazyKartsTrackProgressSubsystem::GetNetPriorityScale(const APawn* Kart, const AActor* ViewTarget) const
+{
+	const FKrazyKartsKartProgress* KartProgress = GetProgress(Kart);
+	const FKrazyKartsKartProgress* ViewerProgress = GetProgress(Cast<APawn>(ViewTarget));
+	if (KartProgress == nullptr || ViewerProgress == nullptr || KartProgress->Track != ViewerProgress->Track) return 1.f;
+
+	return FMath::Abs(KartProgress->Position - ViewerProgress->Position) <= RivalPositionRange ? RivalNetPriorityScale : 1.f;
+}
+
+bool UKrazyKartsTrackProgressSubsystem::UpdateProgress(FKrazyKartsKartProgress& Progress, const FVector& Location) const
+{
+	const FKrazyKartsTrackIndex& TrackIndex = Tracks[Progress.Track];
+	const int32 NumSegments = TrackIndex.Segments.Num();
+
+	int32 Steps = 0;
+	float Alpha = ProjectOnSegment(TrackIndex.Segments[Progress.Segment], Location);
+	while (Alpha > 1.f && Steps < MaxSegmentSteps)
+	{
+		Progress.Segment = (Progress.Segment + 1) % NumSegments;
+		if (Progress.Segment == 0)
+		{
+			++Progress.Lap;
+		}
+		Alpha = ProjectOnSegment(TrackIndex.Segments[Progress.Segment], Location);
+		++Steps;
+	}
+
+	// Driving backwards. On the outside of a corner this can also undo the step above, which leaves the lap count as it was
+	while (Alpha < 0.f && Steps < MaxSegmentSteps)
+	{
+		if (Progress.Segment == 0)
+		{
+			--Progress.Lap;
+		}
+		Progress.Segment = (Progress.Segment + NumSegments - 1) % NumSegments;
+		Alpha = ProjectOnSegment(TrackIndex.Segments[Progress.Segment], Location);
+		++Steps;
+	}
+
+	INC_DWORD_STAT_BY(STAT_TrackSegmentSteps, Steps);
+
+	const FKrazyKartsTrackIndex::FSegment& Segment = TrackIndex.Segments[Progress.Segment];
+	if (Steps >= MaxSegmentSteps || DistSquaredToSegment(Segment, Location) > FMath::Square(ResyncDistance)) return false;
+
+	Progress.LapDistance = Segment.Distance + FMath::Clamp(Alpha, 0.f, 1.f) * Segment.Length;
+	Progress.RaceDistance = Progress.Lap * TrackIndex.Length + Progress.LapDistance;
+	return true;
+}
+
+void UKrazyKartsTrackProgressSubsystem::ResyncProgress(FKrazyKartsKartProgress& Progress, const FVector& Location) const
+{
+	INC_DWORD_STAT(STAT_TrackResyncs);
+
+	int32 BestTrack = INDEX_NONE;
+	int32 BestSegment = 0;
+	float BestDistSquared = FMath::Square(ResyncDistance);
+	for (int32 TrackIndex = 0; TrackIndex < Tracks.Num(); ++TrackIndex)
+	{
+		const TArray<FKrazyKartsTrackIndex::FSegment>& Segments = Tracks[TrackIndex].Segments;
+		for (int32 SegmentIndex = 0; SegmentIndex < Segments.Num(); ++SegmentIndex)
+		{
+			float DistSquared = DistSquaredToSegment(Segments[SegmentIndex], Location);
+			if (DistSquared < BestDistSquared)
+			{
+				BestDistSquared = DistSquared;
+				BestTrack = TrackIndex;
+				BestSegment = SegmentIndex;
+			}
+		}
+	}
+
+	if (BestTrack == INDEX_NONE) return;
+
+	// A kart that never raced starts lap 0 at the line, or lap -1 if the grid is behind it
+	if (Progress.Segment == INDEX_NONE)
+	{
+		Progress.Lap = BestSegment >= Tracks[BestTrack].Segments.Num() / 2 ? -1 : 0;
+	}
+
+	Progress.Track = BestTrack;
+	Progress.Segment = BestSegment;
+	UpdateProgress(Progress, Location);
+}
+
+ETickableTickType UKrazyKartsTrackProgressSubsystem::GetTickableTickType() const
+{
+	// The CDO is constructed like any other object, it must never end up ticking
+	return HasAnyFlags(RF_ClassDefaultObject) ? ETickableTickType::Never : ETickableTickType::Always;
+}
+
+TStatId UKrazyKartsTrackProgressSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UKrazyKartsTrackProgressSubsystem, STATGROUP_Tickables);
+}
+
+void UKrazyKartsTrackProgressSubsystem::Tick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_TrackProgress);
+
+	if (Tracks.Num() == 0) return;
+
+	for (int32 KartIndex = 0; KartIndex < Karts.Num(); ++KartIndex)
+	{
+		FKrazyKartsKartProgress& Progress = Karts[KartIndex];
+		if (Progress.Kart == nullptr) continue;
+
+		// Parked in the pawn pool. Whoever gets it next starts a new race
+		if (Progress.Kart->IsHidden())
+		{
+			RemoveFromLeaderboard(KartIndex);
+			Progress.Segment = INDEX_NONE;
+			continue;
+		}
+
+		FVector Location = Progress.Kart->GetActorLocation();
+		if (Progress.Track != INDEX_NONE && !UpdateProgress(Progress, Location))
+		{
+			RemoveFromLeaderboard(KartIndex); // Off the track or teleported, keeps its lap count
+		}
+
+		if (Progress.Track == INDEX_NONE)
+		{
+			ResyncProgress(Progress, Location);
+			if (Progress.Track != INDEX_NONE)
+			{
+				Tracks[Progress.Track].Leaderboard.Add(KartIndex);
+			}
+		}
+	}
+
+	for (FKrazyKartsTrackIndex& TrackIndex : Tracks)
+	{
+		SortByRaceDistance(TrackIndex.Leaderboard, Karts);
+	}
+}
+
+void UKrazyKartsTrackProgressSubsystem::RunBenchmark(int32 NumKarts, int32 NumFrames)
+{
+	if (Tracks.Num() == 0)
+	{
+		UE_LOG(LogKrazyKarts, Warning, TEXT("BenchmarkTrackProgress needs an AKrazyKartsTrack in the level"));
+		return;
+	}
+
+	const FKrazyKartsTrackIndex& TrackIndex = Tracks[0];
+	const TArray<FKrazyKartsTrackIndex::FSegment>& Segments = TrackIndex.Segments;
+	const float FrameTime = 1.f / 60.f;
+
+	auto GetLocationAtDistance = [&Segments, &TrackIndex](float Distance)
+	{
+		Distance = FMath::Fmod(Distance, TrackIndex.Length);
+		int32 SegmentIndex = FMath::Max(0, Algo::UpperBoundBy(Segments, Distance, &FKrazyKartsTrackIndex::FSegment::Distance) - 1);
+		const FKrazyKartsTrackIndex::FSegment& Segment = Segments[SegmentIndex];
+		return Segment.Start + Segment.Direction * (Distance - Segment.Distance);
+	};
+
+	// Karts spread over the track, at speeds between 10 and 30 m/s so they keep overtaking each other
+	FRandomStream Random(NumKarts);
+	TArray<float> Distances;
+	TArray<float> Speeds;
+	TArray<FKrazyKartsKartProgress> Incremental;
+	TArray<FKrazyKartsKartProgress> FullSearch;
+	TArray<int32> IncrementalLeaderboard;
+	TArray<int32> FullSearchLeaderboard;
+	TArray<FVector> Locations;
+	Distances.SetNum(NumKarts);
+	Speeds.SetNum(NumKarts);
+	Incremental.SetNum(NumKarts);
+	FullSearch.SetNum(NumKarts);
+	Locations.SetNum(NumKarts);
+	for (int32 i = 0; i < NumKarts; ++i)
+	{
+		Distances[i] = Random.FRand() * TrackIndex.Length;
+		Speeds[i] = Random.FRandRange(1000.f, 3000.f);
+		Incremental[i].Track = 0;
+		Incremental[i].Segment = FMath::Max(0, Algo::UpperBoundBy(Segments, Distances[i], &FKrazyKartsTrackIndex::FSegment::Distance) - 1);
+		IncrementalLeaderboard.Add(i);
+		FullSearchLeaderboard.Add(i);
+	}
+
+	double IncrementalSeconds = 0;
+	double FullSearchSeconds = 0;
+	for (int32 Frame = 0; Frame < NumFrames; ++Frame)
+	{
+		for (int32 i = 0; i < NumKarts; ++i)
+		{
+			Distances[i] += Speeds[i] * FrameTime;
+			Locations[i] = GetLocationAtDistance(Distances[i]);
+		}
+
+		double StartTime = FPlatformTime::Seconds();
+		for (int32 i = 0; i < NumKarts; ++i)
+		{
+			UpdateProgress(Incremental[i], Locations[i]);
+		}
+		SortByRaceDistance(IncrementalLeaderboard, Incremental);
+		IncrementalSeconds += FPlatformTime::Seconds() - StartTime;
+
+		// What it would cost without the index: the closest of all segments for every kart, then a full sort
+		StartTime = FPlatformTime::Seconds();
+		for (int32 i = 0; i < NumKarts; ++i)
+		{
+			int32 BestSegment = 0;
+			float BestDistSquared = MAX_flt;
+			for (int32 SegmentIndex = 0; SegmentIndex < Segments.Num(); ++SegmentIndex)
+			{
+				float DistSquared = DistSquaredToSegment(Segments[SegmentIndex], Locations[i]);
+				if (DistSquared < BestDistSquared)
+				{
+					BestDistSquared = DistSquared;
+					BestSegment = SegmentIndex;
+				}
+			}
+			const FKrazyKartsTrackIndex::FSegment& Segment = Segments[BestSegment];
+			FullSearch[i].LapDistance = Segment.Distance + FMath::Clamp(ProjectOnSegment(Segment, Locations[i]), 0.f, 1.f) * Segment.Length;
+			FullSearch[i].RaceDistance = FMath::FloorToInt(Distances[i] / TrackIndex.Length) * TrackIndex.Length + FullSearch[i].LapDistance;
+		}
+		FullSearchLeaderboard.Sort([&FullSearch](int32 A, int32 B) { return FullSearch[A].RaceDistance > FullSearch[B].RaceDistance; });
+		FullSearchSeconds += FPlatformTime::Seconds() - StartTime;
+	}
+
+	UE_LOG(LogKrazyKarts, Log, TEXT("Track progress, %d karts on %d segments over %d frames: incremental %.4f ms/frame, full search %.4f ms/frame"),
+		NumKarts, Segments.Num(), NumFrames, IncrementalSeconds * 1000.0 / NumFrames, FullSearchSeconds * 1000.0 / NumFrames);
+}
@@ -0,0 +1,138 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "KrazyKartsTrackProgressSubsystem.generated.h"
+
+class AKrazyKartsTrack;
+
+/** Where a kart is in the race */
+USTRUCT()
+struct FKrazyKartsKartProgress
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	APawn* Kart = nullptr;
+
+	/** Index into the subsystem's tracks, INDEX_NONE until the kart has been placed on one */
+	int32 Track = INDEX_NONE;
+
+	/** Segment of the track the kart is on, the search for the next frame starts here. INDEX_NONE before its first race */
+	int32 Segment = INDEX_NONE;
+
+	/** Completed laps. -1 while still behind the start line before the first crossing */
+	int32 Lap = 0;
+
+	/** Distance along the current lap (cm) */
+	float LapDistance = 0;
+
+	/** Lap * track length + LapDistance, what the leaderboard is sorted by */
+	float RaceDistance = 0;
+
+	/** 1 for the leader */
+	int32 Position = 0;
+};
+
+/** A track cut into straight segments, with its own leaderboard */
+USTRUCT()
+struct FKrazyKartsTrackIndex
+{
+	GENERATED_BODY()
+
+	struct FSegment
+	{
+		FVector Start;
+		FVector Direction; // Unit length
+		float Length;
+		float Distance; // Along the track, at Start
+	};
+
+	UPROPERTY()
+	AKrazyKartsTrack* Track = nullptr;
+
+	TArray<FSegment> Segments;
+
+	float Length = 0;
+
+	/** Indices into the subsystem's karts, leader first */
+	TArray<int32> Leaderboard;
+};
+
+/**
+ * Race position and lap of every kart, tracked against the spline of an AKrazyKartsTrack.
+ * Each kart only walks from the segment it was on last frame, so a frame costs O(karts) instead of O(karts x segments).
+ * The leaderboard stays sorted with adjacent swaps, overtakes are rare enough for that to be nearly free.
+ * Runs on clients too, the HUD reads it there and the server uses it to prioritise replication of close rivals.
+ */
+UCLASS(config = Game)
+class KRAZYKARTS_API UKrazyKartsTrackProgressSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+
+	void RegisterTrack(AKrazyKartsTrack* Track);
+
+	void UnregisterTrack(AKrazyKartsTrack* Track);
+
+	void RegisterKart(APawn* Kart);
+
+	void UnregisterKart(APawn* Kart);
+
+	/** Null while the kart isn't on any track */
+	const FKrazyKartsKartProgress* GetProgress(const APawn* Kart) const;
+
+	/** How many karts race on the track of Progress */
+	int32 GetNumRacers(const FKrazyKartsKartProgress& Progress) const;
+
+	/** Replication priority multiplier for Kart, as seen by the player driving ViewTarget */
+	float GetNetPriorityScale(const APawn* Kart, const AActor* ViewTarget) const;
+
+	/** Times incremental tracking against a closest-segment search of every kart, on the first track */
+	void RunBenchmark(int32 NumKarts, int32 NumFrames);
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual ETickableTickType GetTickableTickType() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	virtual TStatId GetStatId() const override;
+	// End FTickableGameObject interface
+
+	/** How many segments a kart may move in one frame before we give up walking and search the whole track */
+	UPROPERTY(Config)
+	int32 MaxSegmentSteps = 16;
+
+	/** A kart further than this from its segment (cm) has left the track or teleported, and is searched for again */
+	UPROPERTY(Config)
+	float ResyncDistance = 3000;
+
+	/** Karts this many places or fewer from the viewer's kart are its rivals */
+	UPROPERTY(Config)
+	int32 RivalPositionRange = 2;
+
+	/** Replication priority multiplier of rivals */
+	UPROPERTY(Config)
+	float RivalNetPriorityScale = 2;
+
+private:
+
+	/** Moves the kart to the segment it is on now, walking from its last one. False if it got lost on the way */
+	bool UpdateProgress(FKrazyKartsKartProgress& Progress, const FVector& Location) const;
+
+	/** Closest segment of any track, for karts that have no idea where they are */
+	void ResyncProgress(FKrazyKartsKartProgress& Progress, const FVector& Location) const;
+
+	void RemoveFromLeaderboard(int32 KartIndex);
+
+	UPROPERTY()
+	TArray<FKrazyKartsTrackIndex> Tracks;
+
+	UPROPERTY()
+	TArray<FKrazyKartsKartProgress> Karts;
+
+	TMap<const APawn*, int32> KartIndices;
+};
@@ -0,0 +1,23 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "KrazyKartsVehicleMovementComponent.h"
+#include "GameFramework/Pawn.h"
+
+PRAGMA_DISABLE_DEPRECATION_WARNINGS
+
+void UKrazyKartsVehicleMovementComponent::GetDriverInputs(float& OutThrottle, float& OutSteering) const
+{
+	APawn* Pawn = GetPawnOwner();
+	if (Pawn != nullptr && Pawn->IsLocallyControlled())
+	{
+		OutThrottle = RawThrottleInput;
+		OutSteering = RawSteeringInput;
+		return;
+	}
+
+	// With reverse as brake the replicated throttle is unsigned and the gear gives the direction. Braking is left to the rolling resistance
+	OutThrottle = ReplicatedState.CurrentGear < 0 ? -ReplicatedState.ThrottleInput : ReplicatedState.ThrottleInput;
+	OutSteering = ReplicatedState.SteeringInput;
+}
+
+PRAGMA_ENABLE_DEPRECATION_WARNINGS
@@ -0,0 +1,27 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "WheeledVehicleMovementComponent4W.h"
+#include "KrazyKartsVehicleMovementComponent.generated.h"
+
+PRAGMA_DISABLE_DEPRECATION_WARNINGS
+
+/** The PhysX vehicle of AKrazyKartsPawn, with its inputs readable for the kinematic simulation LOD */
+UCLASS()
+class KRAZYKARTS_API UKrazyKartsVehicleMovementComponent : public UWheeledVehicleMovementComponent4W
+{
+	GENERATED_BODY()
+
+public:
+
+	/**
+	 * Throttle (-1 reverse .. 1) and steering the vehicle is driven with, wherever they come from.
+	 * A local controller (the player on this machine, or AI on the server) sets the raw inputs directly.
+	 * For a remote player they are the last ones its client sent, which keep arriving while the vehicle's tick is off
+	 */
+	void GetDriverInputs(float& OutThrottle, float& OutSteering) const;
+};
+
+PRAGMA_ENABLE_DEPRECATION_WARNINGS
@@ -0,0 +1,236 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "KrazyKartsVehicleSubsystem.h"
+#include "KrazyKarts.h"
+#include "KrazyKartsPawn.h"
+#include "KrazyKartsMatchSubsystem.h"
+#include "KrazyKartsOverloadSubsystem.h"
+#include "GameFramework/PlayerController.h"
+#include "Engine/World.h"
+#include "PhysicsEngine/PhysicsSettings.h"
+#include "WheeledVehicleMovementComponent.h"
+#include "VehicleWheel.h"
+#include "IAnimationBudgetAllocator.h"
+#include "SkeletalMeshComponentBudgeted.h"
+
+DECLARE_CYCLE_STAT(TEXT("Vehicle Simulation LOD"), STAT_VehicleSimulationLOD, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Full Simulation Vehicles"), STAT_FullSimulationVehicles, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Kinematic Vehicles"), STAT_KinematicVehicles, STATGROUP_KrazyKarts);
+DECLARE_CYCLE_STAT(TEXT("Wheel Substep Budget"), STAT_WheelSubstepBudget, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Wheel Substeps"), STAT_WheelSubsteps, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Scene Substeps"), STAT_SceneSubsteps, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Substep Budget Throttled Vehicles"), STAT_SubstepThrottledVehicles, STATGROUP_KrazyKarts);
+DECLARE_CYCLE_STAT(TEXT("Animation Significance"), STAT_AnimationSignificance, STATGROUP_KrazyKarts);
+
+void UKrazyKartsVehicleSubsystem::RegisterVehicle(AKrazyKartsPawn* Vehicle)
+{
+	Vehicles.AddUnique(Vehicle);
+}
+
+void UKrazyKartsVehicleSubsystem::UnregisterVehicle(AKrazyKartsPawn* Vehicle)
+{
+	Vehicles.RemoveSingleSwap(Vehicle);
+}
+
+ETickableTickType UKrazyKartsVehicleSubsystem::GetTickableTickType() const
+{
+	// The CDO is constructed like any other object, it must never end up ticking
+	return HasAnyFlags(RF_ClassDefaultObject) ? ETickableTickType::Never : ETickableTickType::Always;
+}
+
+TStatId UKrazyKartsVehicleSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UKrazyKartsVehicleSubsystem, STATGROUP_Tickables);
+}
+
+void UKrazyKartsVehicleSubsystem::Tick(float DeltaTime)
+{
+	UpdateSimulationLOD();
+	UpdateWheelSubsteps(DeltaTime);
+	UpdateAnimationBudget();
+}
+
+void UKrazyKartsVehicleSubsystem::GatherViewLocations(bool bLocalOnly, TArray<FVector, TInlineAllocator<8>>& OutViewLocations) const
+{
+	// On a server this includes the remote players, their view point is approximated from their pawn
+	for (FConstPlayerControllerIterator Iterator = GetWorld()->GetPlayerControllerIterator(); Iterator; ++Iterator)
+	{
+		APlayerController* PlayerController = Iterator->Get();
+		if (PlayerController == nullptr || (bLocalOnly && !PlayerController->IsLocalController())) continue;
+
+		FVector Location;
+		FRotator Rotation;
+		PlayerController->GetPlayerViewPoint(Location, Rotation);
+		OutViewLocations.Add(Location);
+	}
+}
+
+void UKrazyKartsVehicleSubsystem::UpdateSimulationLOD()
+{
+	SCOPE_CYCLE_COUNTER(STAT_VehicleSimulationLOD);
+
+	UWorld* World = GetWorld();
+	if (World == nullptr || Vehicles.Num() == 0) return;
+
+	TArray<FVector, TInlineAllocator<8>> ViewLocations;
+	GatherViewLocations(false, ViewLocations);
+
+	struct FVehicleDistance
+	{
+		AKrazyKartsPawn* Vehicle;
+		float DistanceSquared;
+	};
+
+	TArray<FVehicleDistance, TInlineAllocator<64>> Candidates;
+	for (AKrazyKartsPawn* Vehicle : Vehicles)
+	{
+		if (Vehicle == nullptr || Vehicle->GetLocalRole() != ROLE_Authority) continue; // Everyone else gets their movement replicated
+		if (Vehicle->IsHidden()) continue; // Parked in the game mode's pawn pool
+
+		float DistanceSquared = ViewLocations.Num() > 0 ? MAX_flt : 0; // Without any viewer (e.g. an empty server) there is nobody to pick, keep full simulation
+		for (const FVector& ViewLocation : ViewLocations)
+		{
+			DistanceSquared = FMath::Min(DistanceSquared, FVector::DistSquared(ViewLocation, Vehicle->GetActorLocation()));
+		}
+
+		Candidates.Add({ Vehicle, DistanceSquared });
+	}
+
+	Candidates.Sort([](const FVehicleDistance& A, const FVehicleDistance& B) { return A.DistanceSquared < B.DistanceSquared; });
+
+	const UKrazyKartsOverloadSubsystem* OverloadSubsystem = World->GetSubsystem<UKrazyKartsOverloadSubsystem>();
+	int32 MaxFullVehicles = OverloadSubsystem != nullptr ? OverloadSubsystem->GetMaxFullSimulationVehicles(MaxFullSimulationVehicles) : MaxFullSimulationVehicles;
+
+	// Each match gets the full budget, so a crowded race can't starve the others on the same server
+	const UKrazyKartsMatchSubsystem* MatchSubsystem = World->GetSubsystem<UKrazyKartsMatchSubsystem>();
+	TArray<int32, TInlineAllocator<8>> MatchFullSimulationCounts;
+	MatchFullSimulationCounts.SetNumZeroed(MatchSubsystem != nullptr ? MatchSubsystem->GetNumMatches() : 1);
+
+	int32 FullSimulationCount = 0;
+	for (const FVehicleDistance& Candidate : Candidates)
+	{
+		// Hysteresis: a vehicle keeps its current LOD while it is between the two distances
+		bool bIsFull = Candidate.Vehicle->GetSimulationLOD() == EKrazyKartsSimulationLOD::Full;
+		float SwitchDistance = bIsFull ? KinematicSimulationDistance : FullSimulationDistance;
+		bool bWantsFull = Candidate.DistanceSquared < FMath::Square(SwitchDistance);
+
+		int32 MatchId = MatchSubsystem != nullptr ? MatchSubsystem->GetActorMatch(Candidate.Vehicle) : INDEX_NONE;
+		int32& MatchFullSimulationCount = MatchFullSimulationCounts[MatchFullSimulationCounts.IsValidIndex(MatchId) ? MatchId : 0];
+
+		if (bWantsFull && MatchFullSimulationCount < MaxFullVehicles)
+		{
+			Candidate.Vehicle->SetSimulationLOD(EKrazyKartsSimulationLOD::Full);
+			++MatchFullSimulationCount;
+			++FullSimulationCount;
+		}
+		else
+		{
+			Candidate.Vehicle->SetSimulationLOD(EKrazyKartsSimulationLOD::Kinematic);
+		}
+	}
+
+	SET_DWORD_STAT(STAT_FullSimulationVehicles, FullSimulationCount);
+	SET_DWORD_STAT(STAT_KinematicVehicles, Candidates.Num() - FullSimulationCount);
+}
+
+void UKrazyKartsVehicleSubsystem::UpdateWheelSubsteps(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_WheelSubstepBudget);
+
+	if (Vehicles.Num() == 0) return;
+
+	// Every wheel substep runs once per scene substep, and a long frame means more scene substeps
+	int32 SceneSubsteps = 1;
+	const UPhysicsSettings* PhysicsSettings = UPhysicsSettings::Get();
+	if (PhysicsSettings->bSubstepping && PhysicsSettings->MaxSubstepDeltaTime > 0)
+	{
+		SceneSubsteps = FMath::Clamp(FMath::CeilToInt(DeltaTime / PhysicsSettings->MaxSubstepDeltaTime), 1, PhysicsSettings->MaxSubsteps);
+	}
+
+	const UKrazyKartsOverloadSubsystem* OverloadSubsystem = GetWorld()->GetSubsystem<UKrazyKartsOverloadSubsystem>();
+	int32 Budget = OverloadSubsystem != nullptr ? OverloadSubsystem->GetMaxWheelSubstepsPerFrame(MaxWheelSubstepsPerFrame) : MaxWheelSubstepsPerFrame;
+	int32 TotalSubsteps = 0;
+	int32 ThrottledVehicles = 0;
+
+	SubstepBudgetOffset = (SubstepBudgetOffset + 1) % Vehicles.Num();
+
+	for (int32 i = 0; i < Vehicles.Num(); ++i)
+	{
+		AKrazyKartsPawn* Vehicle = Vehicles[(SubstepBudgetOffset + i) % Vehicles.Num()];
+		if (Vehicle == nullptr || Vehicle->GetLocalRole() != ROLE_Authority || Vehicle->GetSimulationLOD() != EKrazyKartsSimulationLOD::Full) continue;
+		if (Vehicle->IsHidden()) continue; // Parked in the pawn pool at Full LOD, but with physics off it costs nothing
+
+		UWheeledVehicleMovementComponent* VehicleMovement = Vehicle->GetVehicleMovementComponent();
+
+		bool bAnyWheelInContact = false;
+		for (UVehicleWheel* Wheel : VehicleMovement->Wheels)
+		{
+			if (Wheel != nullptr && !Wheel->IsInAir())
+			{
+				bAnyWheelInContact = true;
+				break;
+			}
+		}
+
+		int32 Substeps = 1; // In the air there is no tire force to resolve
+		if (bAnyWheelInContact)
+		{
+			Substeps = FMath::Abs(VehicleMovement->GetForwardSpeed()) < SubstepSpeedThreshold ? LowSpeedWheelSubsteps : HighSpeedWheelSubsteps;
+		}
+
+		int32 Cost = Substeps * SceneSubsteps;
+		if (Substeps > 1 && Cost > Budget)
+		{
+			Substeps = 1;
+			Cost = SceneSubsteps;
+			++ThrottledVehicles;
+		}
+
+		Budget -= Cost;
+		TotalSubsteps += Cost;
+
+		Vehicle->SetWheelSubsteps(Substeps);
+	}
+
+	SET_DWORD_STAT(STAT_WheelSubsteps, TotalSubsteps);
+	SET_DWORD_STAT(STAT_SceneSubsteps, SceneSubsteps);
+	SET_DWORD_STAT(STAT_SubstepThrottledVehicles, ThrottledVehicles);
+}
+
+void UKrazyKartsVehicleSubsystem::UpdateAnimationBudget()
+{
+	SCOPE_CYCLE_COUNTER(STAT_AnimationSignificance);
+
+	UWorld* World = GetWorld();
+	if (World == nullptr || World->GetNetMode() == NM_DedicatedServer || Vehicles.Num() == 0) return;
+
+	IAnimationBudgetAllocator* BudgetAllocator = IAnimationBudgetAllocator::Get(World);
+	if (BudgetAllocator == nullptr) return;
+
+	// Split-screen players all share one budget, a kart only has to be close to one of them
+	TArray<FVector, TInlineAllocator<8>> ViewLocations;
+	GatherViewLocations(true, ViewLocations);
+
+	for (AKrazyKartsPawn* Vehicle : Vehicles)
+	{
+		if (Vehicle == nullptr || Vehicle->IsHidden()) continue;
+
+		USkeletalMeshComponentBudgeted* Mesh = Cast<USkeletalMeshComponentBudgeted>(Vehicle->GetMesh());
+		if (Mesh == nullptr || !Mesh->IsRegistered()) continue;
+
+		float DistanceSquared = ViewLocations.Num() > 0 ? MAX_flt : 0;
+		for (const FVector& ViewLocation : ViewLocations)
+		{
+			DistanceSquared = FMath::Min(DistanceSquared, FVector::DistSquared(ViewLocation, Vehicle->GetActorLocation()));
+		}
+
+		float Significance = 1.f / (1.f + FMath::Sqrt(DistanceSquared) / AnimationSignificanceDistance);
+		if (!Mesh->WasRecentlyRendered())
+		{
+			Significance *= HiddenAnimationSignificanceScale;
+		}
+
+		// Our own kart always animates at full rate
+		BudgetAllocator->SetComponentSignificance(Mesh, Significance, Vehicle->IsLocallyControlled());
+	}
+}
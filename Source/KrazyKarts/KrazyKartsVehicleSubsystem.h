@@ -0,0 +1,89 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "KrazyKartsVehicleSubsystem.generated.h"
+
+class AKrazyKartsPawn;
+
+/**
+ * Decides, once per frame, how much simulation each AKrazyKartsPawn gets.
+ * Vehicles close to a viewer run the full PhysX wheeled vehicle, distant ones fall back to the kinematic
+ * UGoKartMovementComponent model. Only vehicles this machine has authority over are managed.
+ */
+UCLASS(config = Game)
+class KRAZYKARTS_API UKrazyKartsVehicleSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+
+	void RegisterVehicle(AKrazyKartsPawn* Vehicle);
+
+	void UnregisterVehicle(AKrazyKartsPawn* Vehicle);
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual ETickableTickType GetTickableTickType() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	virtual TStatId GetStatId() const override;
+	// End FTickableGameObject interface
+
+	/** Vehicles closer than this to a viewer (cm) switch to full PhysX simulation */
+	UPROPERTY(Config)
+	float FullSimulationDistance = 5000;
+
+	/** Vehicles further than this from every viewer (cm) switch to the kinematic model. The gap to FullSimulationDistance is the hysteresis */
+	UPROPERTY(Config)
+	float KinematicSimulationDistance = 6000;
+
+	/** How many vehicles of one match may run the full PhysX simulation in one frame, the closest ones win */
+	UPROPERTY(Config)
+	int32 MaxFullSimulationVehicles = 16;
+
+	/** Wheel substeps for vehicles slower than SubstepSpeedThreshold, the PhysX tire model needs them to stay stable at low speed */
+	UPROPERTY(Config)
+	int32 LowSpeedWheelSubsteps = 3;
+
+	/** Wheel substeps for vehicles faster than SubstepSpeedThreshold */
+	UPROPERTY(Config)
+	int32 HighSpeedWheelSubsteps = 1;
+
+	/** Speed (cm/s) above which a vehicle uses HighSpeedWheelSubsteps */
+	UPROPERTY(Config)
+	float SubstepSpeedThreshold = 500;
+
+	/** Total wheel substeps all vehicles may run in one frame, scene substeps included. Vehicles over it get a single substep this frame */
+	UPROPERTY(Config)
+	int32 MaxWheelSubstepsPerFrame = 96;
+
+	/** Distance to the closest local view (cm) at which a kart's animation significance has halved */
+	UPROPERTY(Config)
+	float AnimationSignificanceDistance = 2000;
+
+	/** Animation significance multiplier for karts that were not rendered recently, so visible karts win the budget */
+	UPROPERTY(Config)
+	float HiddenAnimationSignificanceScale = 0.1f;
+
+private:
+
+	/** View points of the players, only the local ones (all split-screen players) if bLocalOnly */
+	void GatherViewLocations(bool bLocalOnly, TArray<FVector, TInlineAllocator<8>>& OutViewLocations) const;
+
+	/** Feeds every kart's significance to the animation budget allocator, which decides who gets full rate wheel animation */
+	void UpdateAnimationBudget();
+
+	void UpdateSimulationLOD();
+
+	/** Picks the wheel substep count of every fully simulated vehicle from its speed and wheel contact, within MaxWheelSubstepsPerFrame */
+	void UpdateWheelSubsteps(float DeltaTime);
+
+	// Where the next frame starts handing out the substep budget, so the vehicles that miss out change every frame
+	int32 SubstepBudgetOffset = 0;
+
+	UPROPERTY()
+	TArray<AKrazyKartsPawn*> Vehicles;
+};
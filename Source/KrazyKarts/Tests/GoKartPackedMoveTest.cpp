@@ -0,0 +1,90 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Misc/AutomationTest.h"
+#include "GoKartMovementComponent.h"
+#include "Engine/World.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+/** Moves of a driver weaving down a road, with inputs that are never exactly on the quantization grid */
+static FGoKartMove MakeDriverMove(int32 Index, float DeltaTime)
+{
+	FGoKartMove Move;
+	Move.Throttle = FMath::Clamp(0.75f + 0.4f * FMath::Sin(Index * 0.0731f), -1.f, 1.f);
+	Move.SteeringThrow = 0.6f * FMath::Sin(Index * 0.0417f + 0.3f);
+	Move.DeltaTime = DeltaTime * (1.f + 0.1f * FMath::Sin(Index * 0.913f)); // Frame times vary a little
+	Move.Sequence = Index;
+	return Move;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FGoKartPackedMoveToleranceTest, "KrazyKarts.PackedMove.SimulationTolerance", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FGoKartPackedMoveToleranceTest::RunTest(const FString& Parameters)
+{
+	// Simulated for 20 s at 60 Hz. The packed path may be off by at most 1% of the distance driven
+	static constexpr int32 NumMoves = 1200;
+	static constexpr float MaxRelativeError = 0.01f;
+
+	UWorld* World = UWorld::CreateWorld(EWorldType::Game, false); // Only for the gravity of the rolling resistance
+	UGoKartMovementComponent* Kart = NewObject<UGoKartMovementComponent>(World);
+
+	FTransform FloatTransform;
+	FVector FloatVelocity = FVector::ZeroVector;
+	FTransform PackedTransform;
+	FVector PackedVelocity = FVector::ZeroVector;
+
+	for (int32 i = 0; i < NumMoves; ++i)
+	{
+		FGoKartMove Move = MakeDriverMove(i, 1.f / 60.f);
+		FGoKartPackedMove Packed = FGoKartPackedMove::Pack(Move);
+
+		Kart->PredictMove(Move, FloatTransform, FloatVelocity);
+		Kart->PredictMove(Packed.Unpack(), PackedTransform, PackedVelocity);
+
+		// What the replicator sends is repacked from the unpacked move, that must not lose anything
+		FGoKartPackedMove Repacked = FGoKartPackedMove::Pack(Packed.Unpack());
+		if (!Repacked.HasSameInputs(Packed) || Repacked.DeltaTime != Packed.DeltaTime || Repacked.Sequence != Packed.Sequence)
+		{
+			AddError(FString::Printf(TEXT("Move %d changes when it is packed a second time"), i));
+			break;
+		}
+	}
+
+	float Distance = FloatTransform.GetLocation().Size();
+	float Error = FVector::Dist(FloatTransform.GetLocation(), PackedTransform.GetLocation());
+
+	TestTrue(TEXT("The kart actually drove"), Distance > 1000.f);
+	TestTrue(FString::Printf(TEXT("Position error %.2f cm after %.0f cm stays within %.0f%%"), Error, Distance, MaxRelativeError * 100.f), Error <= Distance * MaxRelativeError);
+
+	World->DestroyWorld(false);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FGoKartPackedMoveSequenceTest, "KrazyKarts.PackedMove.SequenceWrap", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FGoKartPackedMoveSequenceTest::RunTest(const FString& Parameters)
+{
+	FGoKartPackedMove Last;
+	Last.Sequence = MAX_uint32;
+
+	FGoKartPackedMove First;
+	First.Sequence = 0;
+
+	FGoKartPackedMove Later;
+	Later.Sequence = 41;
+
+	TestTrue(TEXT("The move after the wrap is newer"), First.IsNewerThan(Last));
+	TestFalse(TEXT("The move before the wrap is older"), Last.IsNewerThan(First));
+	TestTrue(TEXT("Moves well past the wrap are newer"), Later.IsNewerThan(Last));
+	TestFalse(TEXT("A move is not newer than itself"), Last.IsNewerThan(Last));
+
+	FGoKartPackedMove Middle;
+	Middle.Sequence = 0x80000000u;
+	FGoKartPackedMove BeforeMiddle;
+	BeforeMiddle.Sequence = 0x7fffffffu;
+	TestTrue(TEXT("Ordering holds across the sign bit"), Middle.IsNewerThan(BeforeMiddle));
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
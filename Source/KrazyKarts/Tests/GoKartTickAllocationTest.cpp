@@ -0,0 +1,296 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Misc/AutomationTest.h"
+#include "HAL/MallocBase.h"
+#include "GoKart.h"
+#include "GoKartMovementComponent.h"
+#include "GoKartMovementReplicator.h"
+#include "KrazyKartsPawn.h"
+#include "KrazyKartsHud.h"
+#include "Components/SphereComponent.h"
+#include "Engine/World.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+/** Forwards everything to the allocator it replaces, counting the game thread's allocations while it is installed as GMalloc */
+class FGoKartCountingMalloc final : public FMalloc
+{
+public:
+
+	explicit FGoKartCountingMalloc(FMalloc* InInner) : Inner(InInner) {}
+
+	FMalloc* GetInner() const { return Inner; }
+
+	int32 GetNumAllocations() const { return NumAllocations; }
+
+	void ResetNumAllocations() { NumAllocations = 0; }
+
+	virtual void* Malloc(SIZE_T Count, uint32 Alignment) override
+	{
+		CountAllocation();
+		return Inner->Malloc(Count, Alignment);
+	}
+
+	virtual void* TryMalloc(SIZE_T Count, uint32 Alignment) override
+	{
+		CountAllocation();
+		return Inner->TryMalloc(Count, Alignment);
+	}
+
+	virtual void* Realloc(void* Original, SIZE_T Count, uint32 Alignment) override
+	{
+		CountAllocation();
+		return Inner->Realloc(Original, Count, Alignment);
+	}
+
+	virtual void* TryRealloc(void* Original, SIZE_T Count, uint32 Alignment) override
+	{
+		CountAllocation();
+		return Inner->TryRealloc(Original, Count, Alignment);
+	}
+
+	virtual void Free(void* Original) override { Inner->Free(Original); }
+	virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override { return Inner->QuantizeSize(Count, Alignment); }
+	virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override { return Inner->GetAllocationSize(Original, SizeOut); }
+	virtual void Trim(bool bTrimThreadCaches) override { Inner->Trim(bTrimThreadCaches); }
+	virtual void SetupTLSCachesOnCurrentThread() override { Inner->SetupTLSCachesOnCurrentThread(); }
+	virtual void ClearAndDisableTLSCachesOnCurrentThread() override { Inner->ClearAndDisableTLSCachesOnCurrentThread(); }
+	virtual bool IsInternallyThreadSafe() const override { return Inner->IsInternallyThreadSafe(); }
+	virtual bool ValidateHeap() override { return Inner->ValidateHeap(); }
+	virtual const TCHAR* GetDescriptiveName() override { return Inner->GetDescriptiveName(); }
+
+private:
+
+	// Other threads keep allocating while the test runs, only what the kart does counts
+	void CountAllocation()
+	{
+		if (IsInGameThread())
+		{
+			++NumAllocations;
+		}
+	}
+
+	FMalloc* Inner;
+
+	int32 NumAllocations = 0;
+};
+
+/**
+ * Puts a counting allocator in front of GMalloc for its scope. GMalloc is a plain pointer every thread reads without synchronization,
+ * so around the swaps other threads may still use either allocator. Any mix is safe: memory from either side can be freed through the
+ * other, both end up in the same allocator, and only the game thread touches the count.
+ * The counting allocator is never destroyed, a thread that read the pointer just before the scope ended may still be calling into it
+ */
+struct FGoKartCountingMallocScope
+{
+	FGoKartCountingMallocScope() : CountingMalloc(Get())
+	{
+		check(GMalloc == CountingMalloc.GetInner());
+		CountingMalloc.ResetNumAllocations();
+
+		// Published with a barrier, so no thread sees the pointer before the allocator behind it
+		FPlatformAtomics::InterlockedExchangePtr((void**)&GMalloc, &CountingMalloc);
+	}
+
+	~FGoKartCountingMallocScope()
+	{
+		FPlatformAtomics::InterlockedExchangePtr((void**)&GMalloc, CountingMalloc.GetInner());
+	}
+
+	FGoKartCountingMalloc& CountingMalloc;
+
+private:
+
+	static FGoKartCountingMalloc& Get()
+	{
+		static FGoKartCountingMalloc Instance(GMalloc);
+		return Instance;
+	}
+};
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FGoKartTickAllocationTest, "KrazyKarts.Tick.NoAllocations", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FGoKartTickAllocationTest::RunTest(const FString& Parameters)
+{
+	// A few karts close together, so the broadphase has collisions to resolve and karts change cells
+	static constexpr int32 NumKarts = 4;
+	static constexpr int32 NumWarmUpFrames = 120;
+	static constexpr int32 NumFrames = 600;
+
+	UWorld* World = UWorld::CreateWorld(EWorldType::Game, false);
+	World->InitializeActorsForPlay(FURL());
+
+	struct FKart
+	{
+		UGoKartMovementComponent* MovementComponent;
+		UGoKartMovementReplicator* MovementReplicator;
+	};
+
+	// Without a net driver the roles are all that tells a kart which side of the connection it is on
+	auto SpawnKart = [World](const FVector& Location, ENetRole Role, ENetRole RemoteRole)
+	{
+		FActorSpawnParameters SpawnInfo;
+		SpawnInfo.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+		AGoKart* Kart = World->SpawnActor<AGoKart>(AGoKart::StaticClass(), FTransform(Location), SpawnInfo);
+		Kart->SetRole(Role);
+		Kart->SetRemoteRoleForBackwardsCompat(RemoteRole);
+
+		// The blueprint gives the kart its collision, without a root it would never move
+		USphereComponent* Root = NewObject<USphereComponent>(Kart, TEXT("Root"));
+		Root->SetSphereRadius(100.f);
+		Kart->SetRootComponent(Root);
+		Root->SetWorldLocation(Location);
+		Root->RegisterComponent();
+
+		// Stands in for the blueprint's mesh, so corrections are eased on it
+		USceneComponent* Visuals = NewObject<USceneComponent>(Kart, TEXT("Visuals"));
+		Visuals->ComponentTags.Add(TEXT("MeshOffsetRoot"));
+		Visuals->SetupAttachment(Root);
+		Visuals->RegisterComponent();
+
+		FKart Entry;
+		Entry.MovementComponent = Kart->FindComponentByClass<UGoKartMovementComponent>();
+		Entry.MovementReplicator = Kart->FindComponentByClass<UGoKartMovementReplicator>();
+
+		// A client's copies of a kart live in another world than the server's, here they must not run into it
+		if (Role != ROLE_Authority)
+		{
+			Root->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+			Entry.MovementComponent->SetUseKartBroadphase(false);
+		}
+
+		// The world never begins play without a game mode
+		Kart->DispatchBeginPlay();
+		return Entry;
+	};
+
+	// Karts driven on a listen server
+	TArray<FKart> Karts;
+	for (int32 i = 0; i < NumKarts; ++i)
+	{
+		Karts.Add(SpawnKart(FVector(i * 250.f, 0.f, 0.f), ROLE_Authority, ROLE_SimulatedProxy));
+	}
+
+	// A remote player's kart: the server's copy, the owning client's and another client's
+	FKart ServerKart = SpawnKart(FVector(NumKarts * 250.f, 0.f, 0.f), ROLE_Authority, ROLE_AutonomousProxy);
+	FKart AutonomousKart = SpawnKart(FVector(NumKarts * 250.f, 0.f, 0.f), ROLE_AutonomousProxy, ROLE_Authority);
+	FKart SimulatedKart = SpawnKart(FVector(NumKarts * 250.f, 0.f, 0.f), ROLE_SimulatedProxy, ROLE_Authority);
+
+	// Only its HUD strings are ticked, so it never begins play and streams no assets. Without a PhysX vehicle speed and gear hold still
+	FActorSpawnParameters SpawnInfo;
+	SpawnInfo.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	AKrazyKartsPawn* Vehicle = World->SpawnActor<AKrazyKartsPawn>(AKrazyKartsPawn::StaticClass(), FTransform(FVector(0.f, 2000.f, 0.f)), SpawnInfo);
+	AKrazyKartsHud* Hud = World->SpawnActor<AKrazyKartsHud>(AKrazyKartsHud::StaticClass(), SpawnInfo);
+
+	// Runs the client sent that haven't reached the server yet start after this one
+	FGoKartPackedMove LastDeliveredRun;
+	bool bDeliveredRun = false;
+
+	// The ServerState the clients received last
+	FGoKartPackedMove LastReplicatedMove;
+	bool bReplicatedState = false;
+
+	int32 MovementAllocations = 0;
+	int32 ReplicationAllocations = 0;
+	int32 ClientAllocations = 0;
+	int32 ServerAllocations = 0;
+	int32 HUDAllocations = 0;
+	{
+		FGoKartCountingMallocScope CountingScope;
+		FGoKartCountingMalloc& CountingMalloc = CountingScope.CountingMalloc;
+
+		// The first frames grow every buffer and container to its steady size
+		auto Count = [&CountingMalloc](int32 Frame, int32& InOutAllocations, auto&& Tick)
+		{
+			CountingMalloc.ResetNumAllocations();
+			Tick();
+			if (Frame >= NumWarmUpFrames)
+			{
+				InOutAllocations += CountingMalloc.GetNumAllocations();
+			}
+		};
+
+		for (int32 Frame = 0; Frame < NumWarmUpFrames + NumFrames; ++Frame)
+		{
+			// Frames shorter than a simulation step too, and steering changes that force ServerState updates
+			float DeltaTime = (Frame % 3 == 0) ? 1.f / 144.f : 1.f / 50.f;
+			float SteeringThrow = ((Frame / 40) % 2 == 0) ? 0.8f : -0.3f;
+
+			for (int32 i = 0; i < Karts.Num(); ++i)
+			{
+				FKart& Kart = Karts[i];
+				Kart.MovementComponent->SetThrottle(i % 2 == 0 ? 1.f : -0.5f);
+				Kart.MovementComponent->SetSteeringThrow(SteeringThrow);
+
+				Count(Frame, MovementAllocations, [&Kart, DeltaTime]() { Kart.MovementComponent->TickMovement(DeltaTime); });
+				Count(Frame, ReplicationAllocations, [&Kart, DeltaTime]() { Kart.MovementReplicator->TickReplication(DeltaTime); });
+			}
+
+			// The owning client predicts and coalesces its runs. Server_SendMove has no connection to go out on, it is absorbed
+			AutonomousKart.MovementComponent->SetThrottle(1.f);
+			AutonomousKart.MovementComponent->SetSteeringThrow(SteeringThrow);
+			Count(Frame, ClientAllocations, [&AutonomousKart, DeltaTime]()
+			{
+				AutonomousKart.MovementComponent->TickMovement(DeltaTime);
+				AutonomousKart.MovementReplicator->TickReplication(DeltaTime);
+			});
+
+			// What the RPC would have delivered: every run the client sent since the last frame, in order
+			Count(Frame, ServerAllocations, [&]()
+			{
+				for (const FGoKartPackedMove& Run : AutonomousKart.MovementReplicator->UnacknowledgedMoves)
+				{
+					if (bDeliveredRun && !Run.IsNewerThan(LastDeliveredRun)) continue;
+
+					ServerKart.MovementReplicator->Server_SendMove_Implementation(Run);
+					LastDeliveredRun = Run;
+					bDeliveredRun = true;
+				}
+
+				ServerKart.MovementComponent->TickMovement(DeltaTime);
+				ServerKart.MovementReplicator->TickReplication(DeltaTime);
+			});
+
+			// A published ServerState reaches both clients: the owner acknowledges and replays, the other one extrapolates from it
+			Count(Frame, ClientAllocations, [&]()
+			{
+				const FGoKartState& ServerState = ServerKart.MovementReplicator->ServerState;
+				if (!bReplicatedState || ServerState.LastMove.IsNewerThan(LastReplicatedMove))
+				{
+					for (FKart* Client : { &AutonomousKart, &SimulatedKart })
+					{
+						Client->MovementReplicator->ServerState = ServerState;
+						Client->MovementReplicator->OnRep_ServerState();
+					}
+					LastReplicatedMove = ServerState.LastMove;
+					bReplicatedState = true;
+				}
+
+				SimulatedKart.MovementComponent->TickMovement(DeltaTime);
+				SimulatedKart.MovementReplicator->TickReplication(DeltaTime);
+			});
+
+			// Drawing is the canvas' business, the strings it is given must only be formatted when they change
+			Count(Frame, HUDAllocations, [Vehicle, Hud]()
+			{
+				Vehicle->UpdateHUDStrings();
+				Hud->UpdateRaceText(1, NumKarts, 1);
+			});
+		}
+	}
+
+	TestTrue(TEXT("The server received the client's runs"), bDeliveredRun);
+	TestTrue(TEXT("The clients received a ServerState"), bReplicatedState);
+	TestTrue(TEXT("The client's unacknowledged runs stay inline"), AutonomousKart.MovementReplicator->UnacknowledgedMoves.Num() <= 32);
+
+	TestEqual(FString::Printf(TEXT("Heap allocations in TickMovement over %d frames of %d karts"), NumFrames, NumKarts), MovementAllocations, 0);
+	TestEqual(FString::Printf(TEXT("Heap allocations in TickReplication over %d frames of %d karts"), NumFrames, NumKarts), ReplicationAllocations, 0);
+	TestEqual(FString::Printf(TEXT("Heap allocations of the owning and a simulating client over %d frames"), NumFrames), ClientAllocations, 0);
+	TestEqual(FString::Printf(TEXT("Heap allocations of the server buffering a client's runs over %d frames"), NumFrames), ServerAllocations, 0);
+	TestEqual(FString::Printf(TEXT("Heap allocations in the HUD strings over %d frames"), NumFrames), HUDAllocations, 0);
+
+	World->DestroyWorld(false);
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -9,6 +9,7 @@ public class KrazyKartsEditorTarget : TargetRules
 	{
 		Type = TargetType.Editor;
 		DefaultBuildSettings = BuildSettingsVersion.V2;
+		// No push model here, the editor shares its build environment with the engine. Play In Editor compares ServerState on every pass
 		ExtraModuleNames.Add("KrazyKarts");
 	}
 }